@@ -5,8 +5,16 @@
 
 #define PRINT_INS(...) if(m_print_mode) { std::printf(__VA_ARGS__); }
 
-void CPU::init(const char* psxexe_path)
+CPU::CPU()
 {
+    //the devices are members, so their events can be wired up before init()
+    m_scheduler.set_handler(Scheduler::Event::DMA, [this]() { m_dma.step(); });
+    m_scheduler.set_handler(Scheduler::Event::VBlank, [this]() { vblank(); });
+}
+
+void CPU::init(const Config& config)
+{
+	const char* psxexe_path = config.psxexe_path;
 	
     m_regs.r0  = 0;
     m_regs.pc  = 0xBFC00000;
@@ -16,6 +24,10 @@ void CPU::init(const char* psxexe_path)
     
     memcpy(m_regs.out, m_regs.raw, sizeof(m_regs.out));
     
+    m_gpu.configure(config);
+    
+    m_scheduler.schedule(Scheduler::Event::VBlank, m_gpu.frame_cycles());
+    
     //load program into ram
 	if(psxexe_path != nullptr)
 	{
@@ -38,10 +50,27 @@ void CPU::run()
     {
         //TODO: handle interrupts
         
+        //an unchopped dma transfer owns the bus, the cpu idles until it is handed back
+        if(m_dma.holds_bus())
+        {
+            m_scheduler.advance_to(m_dma.bus_release());
+            continue;
+        }
+        
         exec();
     }
 }
 
+void CPU::vblank()
+{
+    m_gpu.vblank();
+    raise_irq(Interrupt::VBlank);
+    
+    m_last_frame_dma_stats = m_dma.take_frame_stats();
+    
+    m_scheduler.schedule(Scheduler::Event::VBlank, m_gpu.frame_cycles());
+}
+
 void CPU::exec()
 {
     m_curr_pc = m_regs.pc;
@@ -71,6 +100,8 @@ void CPU::exec()
     m_regs[m_regs.first_last_changed_reg]  = m_regs.out[m_regs.first_last_changed_reg];
     m_regs[m_regs.second_last_changed_reg] = m_regs.out[m_regs.second_last_changed_reg];
     
+    m_scheduler.tick(InstructionCycles);
+    
     if(m_slow_mode){}
         //usleep(500000);
 }
@@ -88,6 +119,17 @@ void CPU::print()
     }
 }
 
+CPU::DirtyPages CPU::checkpoint()
+{
+    DirtyPages pages;
+    
+    m_mmu.collect_dirty_ram(pages.ram);
+    m_mmu.collect_dirty_scratchpad(pages.scratchpad);
+    m_gpu.collect_dirty_vram(pages.vram);
+    
+    return pages;
+}
+
 void CPU::exception(Exception cause)
 {
     static const char* exception_names[] =
@@ -132,6 +174,11 @@ void CPU::exception(Exception cause)
     m_regs.npc = m_regs.pc + sizeof(CPUInstruction);
 }
 
+void CPU::raise_irq(Interrupt irq)
+{
+    m_irq.stat |= 1 << static_cast<u8>(irq);
+}
+
 void CPU::branch_jmp(u32 virtual_address)
 {
     m_regs.npc = (m_regs.pc & 0xF0000000) | (virtual_address * sizeof(CPUInstruction));
@@ -7,6 +7,8 @@
 #include "MMU.hpp"
 #include "DMA.hpp"
 #include "GPU.hpp"
+#include "Scheduler.hpp"
+#include "Config.hpp"
 
 class CPU
 {
@@ -28,15 +30,56 @@ public:
         COPUnusable,
         Overflow
     };
+    
+    enum class Interrupt : u8
+    {
+        VBlank     = 0,
+        GPU        = 1,
+        CDROM      = 2,
+        DMA        = 3,
+        Timer0     = 4,
+        Timer1     = 5,
+        Timer2     = 6,
+        Controller = 7,
+        SIO        = 8,
+        SPU        = 9,
+        Lightpen   = 10
+    };
+    
+    /**
+     * average cost of one instruction on the system clock
+     */
+    static constexpr const u32 InstructionCycles = 1;
 
-	CPU() {}
+	CPU();
 
-	void init(const char* psxexe_path);
+	void init(const Config& config);
     void run();
 	void exec();
 	void reset();
     void print();
     void exception(Exception);
+    void raise_irq(Interrupt);
+    
+    /**
+     * pages written since the last checkpoint, the base for incremental save states
+     *
+     * page indices are in units of MMU::DirtyPageSize, VRAM pages cover
+     * GPU::VRAMDirtyTracker::PageSize bytes in row-major order
+     */
+    struct DirtyPages
+    {
+        std::vector<u32> ram;
+        std::vector<u32> scratchpad;
+        std::vector<u32> vram;
+    };
+    
+    DirtyPages checkpoint();
+    
+    /**
+     * DMA telemetry of the last complete frame
+     */
+    const DMA::Stats& last_frame_dma_stats() const { return m_last_frame_dma_stats; }
 
 protected:
     
@@ -104,13 +147,47 @@ protected:
     void branch_jmp(u32 virtual_address);
     void branch_add(s16 amount);
     
+    /**
+     * interrupt controller
+     */
+    struct
+    {
+        u32 stat { 0 };
+        u32 mask { 0 };
+        
+        void set(u8 i, u32 value)
+        {
+            if(static_cast<IRQReg>(i) == IRQReg::STAT)
+            {
+                stat &= value;
+            }
+            else
+            {
+                mask = value & 0x7FF;
+            }
+        }
+        
+        u32 get(u8 i)
+        {
+            return static_cast<IRQReg>(i) == IRQReg::STAT ? stat : mask;
+        }
+        
+        bool pending() const { return (stat & mask) != 0; }
+    } m_irq;
+    
     /**
      * devices
      */
+    Scheduler m_scheduler;
+    
     MMU m_mmu { this };
     DMA m_dma { this };
     GPU m_gpu { this };
     
+    DMA::Stats m_last_frame_dma_stats;
+    
+    void vblank();
+    
     /**
      * base instruction implementation
      */
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <atomic>
+
+/**
+ * lock-free single producer / single consumer ring
+ *
+ * one thread pushes, one thread pops, neither ever blocks in here
+ */
+template<typename T, u32 capacity>
+class CommandRing
+{
+public:
+    
+    static_assert(static_is_power_of_two(capacity));
+    
+    static constexpr const u32 Capacity = capacity;
+    
+    /**
+     * producer side, false when the ring is full
+     */
+    bool push(const T& value)
+    {
+        u32 tail = m_tail.load(std::memory_order_relaxed);
+        
+        if(tail - m_head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        
+        m_slots[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    /**
+     * consumer side, moves up to count entries out and returns how many it got
+     */
+    u32 pop(T* values, u32 count)
+    {
+        u32 head = m_head.load(std::memory_order_relaxed);
+        u32 size = m_tail.load(std::memory_order_acquire) - head;
+        
+        if(count > size)
+        {
+            count = size;
+        }
+        
+        for(u32 i = 0; i < count; i++)
+        {
+            values[i] = m_slots[(head + i) & (Capacity - 1)];
+        }
+        
+        m_head.store(head + count, std::memory_order_release);
+        
+        return count;
+    }
+    
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+    
+private:
+    
+    //producer and consumer indices live on their own cache lines
+    alignas(64) std::atomic<u32> m_head { 0 };
+    alignas(64) std::atomic<u32> m_tail { 0 };
+    alignas(64) T m_slots[Capacity];
+};
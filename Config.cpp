@@ -0,0 +1,131 @@
+#include "Config.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+Config Config::parse(int argc, const char* argv[])
+{
+    Config config;
+    
+    for(int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        
+        if(std::strcmp(arg, "--software") == 0)
+        {
+            config.renderer = RendererType::Software;
+        }
+        else if(std::strcmp(arg, "--opengl") == 0)
+        {
+            config.renderer = RendererType::OpenGL;
+        }
+        else if(std::strcmp(arg, "--null") == 0)
+        {
+            config.renderer = RendererType::Null;
+        }
+        else if(std::strcmp(arg, "--headless") == 0)
+        {
+            config.headless = true;
+        }
+        else if(std::strcmp(arg, "--pacing") == 0 && i + 1 < argc)
+        {
+            const char* mode = argv[++i];
+            
+            if(std::strcmp(mode, "vsync") == 0)
+            {
+                config.pacing = FramePacing::VSync;
+            }
+            else if(std::strcmp(mode, "mailbox") == 0)
+            {
+                config.pacing = FramePacing::Mailbox;
+            }
+            else if(std::strcmp(mode, "uncapped") == 0)
+            {
+                config.pacing = FramePacing::Uncapped;
+            }
+            else
+            {
+                std::printf("Config::parse() warning: unknown frame pacing %s\n", mode);
+            }
+        }
+        else if(std::strcmp(arg, "--gpu-thread") == 0)
+        {
+            config.gpu_thread = true;
+        }
+        else if(std::strcmp(arg, "--threads") == 0 && i + 1 < argc)
+        {
+            config.render_threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(std::strcmp(arg, "--scale") == 0 && i + 1 < argc)
+        {
+            config.resolution_scale = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(std::strcmp(arg, "--benchmark-scales") == 0 && i + 1 < argc)
+        {
+            config.benchmark_frames = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if(std::strcmp(arg, "--record") == 0 && i + 1 < argc)
+        {
+            config.capture_path = argv[++i];
+        }
+        else if(std::strcmp(arg, "--frame-hashes") == 0 && i + 1 < argc)
+        {
+            config.frame_hash_path = argv[++i];
+        }
+        else if(std::strcmp(arg, "--dump-frames") == 0 && i + 1 < argc)
+        {
+            config.frame_dump_path = argv[++i];
+        }
+        else if(std::strcmp(arg, "--shader-cache") == 0 && i + 1 < argc)
+        {
+            config.shader_cache_path = argv[++i];
+        }
+        else if(arg[0] == '-')
+        {
+            std::printf("Config::parse() warning: unknown option %s\n", arg);
+            print_usage(argv[0]);
+        }
+        else
+        {
+            config.psxexe_path = arg;
+        }
+    }
+    
+    if(config.render_threads == 0)
+    {
+        config.render_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    //waiting for the display would hide the frame times being measured
+    if(config.benchmark_frames != 0)
+    {
+        config.pacing = FramePacing::Uncapped;
+    }
+    
+    return config;
+}
+
+void Config::print_usage(const char* program)
+{
+    std::printf("usage: %s [options] [psx executable]\n", program);
+    std::printf("    --opengl      draw primitives with OpenGL (default)\n");
+    std::printf("    --software    draw primitives with the software rasterizer\n");
+    std::printf("    --null        parse GPU commands without drawing anything\n");
+    std::printf("    --headless    never open a window, OpenGL renders into an offscreen context\n");
+    std::printf("    --pacing M    frame pacing: vsync (default), mailbox or uncapped\n");
+    std::printf("    --gpu-thread  run the gpu and renderer on their own thread\n");
+    std::printf("    --threads N   software rasterizer threads, 1 draws immediately (default: one per core)\n");
+    std::printf("    --scale N     OpenGL internal resolution multiplier, 1 to 8 (default: 1)\n");
+    std::printf("    --benchmark-scales N\n");
+    std::printf("                  time N uncapped frames at every internal resolution and exit\n");
+    std::printf("    --record F    record the GPU command stream into F for gpu_replay\n");
+    std::printf("    --frame-hashes F\n");
+    std::printf("                  write a hash of every displayed frame into F\n");
+    std::printf("    --dump-frames P\n");
+    std::printf("                  encode displayed frames into P if it ends in .y4m, else into P_000000.png...\n");
+    std::printf("    --shader-cache D\n");
+    std::printf("                  keep compiled OpenGL programs in the existing directory D\n");
+}
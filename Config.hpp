@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Types.hpp"
+
+/**
+ * emulator options picked on the command line
+ */
+struct Config
+{
+    enum class RendererType : u8
+    {
+        OpenGL,
+        Software,
+        Null      // commands are parsed, nothing is drawn
+    };
+    
+    enum class FramePacing : u8
+    {
+        VSync,    // every present waits for the display
+        Mailbox,  // late presents don't wait for the next refresh
+        Uncapped  // never wait, run as fast as possible
+    };
+    
+    const char*  psxexe_path { nullptr };
+    RendererType renderer    { RendererType::OpenGL };
+    FramePacing  pacing      { FramePacing::VSync };
+    
+    //no window: OpenGL draws offscreen, software and null output is never shown
+    bool         headless    { false };
+    
+    //threads used by the software rasterizer, 0 picks one per core
+    u32          render_threads { 0 };
+    
+    //run the gpu and renderer on their own thread behind a command ring
+    bool         gpu_thread     { false };
+    
+    //OpenGL internal resolution, 1 to 8 times the native VRAM size
+    u32          resolution_scale { 1 };
+    
+    //frames timed at each resolution scale before moving to the next one, 0 runs normally
+    u32          benchmark_frames { 0 };
+    
+    //every GPU port write, DMA burst and vblank is recorded here for gpu_replay
+    const char*  capture_path { nullptr };
+    
+    //every displayed frame is hashed into the first and encoded into the second, see FrameDump
+    const char*  frame_hash_path { nullptr };
+    const char*  frame_dump_path { nullptr };
+    
+    //existing directory linked OpenGL programs are cached in, see ShaderProgram
+    const char*  shader_cache_path { nullptr };
+    
+    static Config parse(int argc, const char* argv[]);
+    static void   print_usage(const char* program);
+};
@@ -1,115 +1,338 @@
 #include "DMA.hpp"
 #include "CPU.hpp"
 
-template<DMA::DMAChannel channel_type>
-void DMA::execute(DMA::Channel& channel)
+#include <algorithm>
+
+static constexpr const u32 RAMWords = 0x200000 / sizeof(u32);
+
+/**
+ * split a transfer into runs which are contiguous in host memory,
+ * only a transfer wrapping around the end of RAM produces more than one run
+ *
+ * fn(first, count) receives word indices, for Direction::Dec first is the lowest
+ * word of the run and the run should be walked from the top
+ */
+template<typename Fn>
+static void for_each_ram_run(u32 address, u32 total, DMA::Direction direction, Fn&& fn)
 {
-    //assert(channel.sync != Sync::LList);
+    u32 word = (address & 0x1FFFFC) >> 2;
+    
+    while(total > 0)
+    {
+        if(direction == DMA::Direction::Inc)
+        {
+            u32 run = std::min(total, RAMWords - word);
+            fn(word, run);
+            word   = (word + run) & (RAMWords - 1);
+            total -= run;
+        }
+        else
+        {
+            u32 run = std::min(total, word + 1);
+            fn(word + 1 - run, run);
+            word   = (word - run) & (RAMWords - 1);
+            total -= run;
+        }
+    }
+}
+
+void DMA::start(u8 channel_index)
+{
+    Channel&  channel  = m_channels[channel_index];
+    Transfer& transfer = m_transfers[channel_index];
+    
+    transfer.cursor    = channel.base & 0x1FFFFC;
+    transfer.remaining = channel.transfer_size();
+    transfer.hare      = transfer.cursor;
+    transfer.hare_done = false;
+    
+    if(channel.sync == Sync::LList)
+    {
+        m_frame_stats.llist_transfers++;
+    }
+    else
+    {
+        m_frame_stats.block_transfers++;
+    }
+    
+    m_running |= 1 << channel_index;
+    
+    //the transfer begins on the next event, the register write itself returns right away
+    if(!m_cpu->m_scheduler.pending(Scheduler::Event::DMA))
+    {
+        m_cpu->m_scheduler.schedule(Scheduler::Event::DMA, 1);
+    }
+}
+
+void DMA::step()
+{
+    if(m_running == 0)
+    {
+        return;
+    }
+    
+    //lower channels win, the DPCR priorities are not modelled
+    u8 channel_index = __builtin_ctz(m_running);
+    
+    Channel&  channel  = m_channels[channel_index];
+    Transfer& transfer = m_transfers[channel_index];
+    
+    //chopped transfers move a window of words and then leave the bus to the cpu for a while
+    u32 budget = channel.chop ? (1 << channel.chop_dma_window) : BurstWords;
+    u32 cycles = 0;
+    bool done  = false;
     
+    switch(channel_index)
+    {
+        case 0: { cycles = this->transfer<DMAChannel::MDECIN>(channel, transfer, budget, done); break; }
+        case 1: { cycles = this->transfer<DMAChannel::MDECOUT>(channel, transfer, budget, done); break; }
+        case 2: { cycles = this->transfer<DMAChannel::GPU>(channel, transfer, budget, done); break; }
+        case 3: { cycles = this->transfer<DMAChannel::CDROM>(channel, transfer, budget, done); break; }
+        case 4: { cycles = this->transfer<DMAChannel::SPU>(channel, transfer, budget, done); break; }
+        case 5: { cycles = this->transfer<DMAChannel::PIO>(channel, transfer, budget, done); break; }
+        case 6: { cycles = this->transfer<DMAChannel::OTC>(channel, transfer, budget, done); break; }
+        default:
+        {
+            assert(false); break;
+        }
+    }
+    
+    m_frame_stats.cycles += cycles;
+    
+    u64 now = m_cpu->m_scheduler.now();
+    
+    m_bus_release = now + cycles;
+    
+    if(done)
+    {
+        finish(channel_index);
+    }
+    
+    if(m_running != 0)
+    {
+        u32 cpu_window = (!done && channel.chop) ? (1 << channel.chop_cpu_window) : 0;
+        
+        m_cpu->m_scheduler.schedule(Scheduler::Event::DMA, std::max<u32>(cycles + cpu_window, 1));
+    }
+}
+
+void DMA::finish(u8 channel_index)
+{
+    Channel& channel = m_channels[channel_index];
+    
+    channel.enabled = false;
+    channel.trigger = false;
+    
+    m_running &= ~(1 << channel_index);
+    
+    if(irq_channels() & (1 << channel_index))
+    {
+        m_regs.interrupt |= 1 << (24 + channel_index);
+    }
+    
+    update_irq();
+}
+
+void DMA::update_irq()
+{
+    bool was_active = irq_active();
+    bool active     = irq_force() || (irq_en() && (irq_channels() & irq_channels_reset()));
+    
+    if(active)
+    {
+        m_regs.interrupt |= 1u << 31;
+    }
+    else
+    {
+        m_regs.interrupt &= ~(1u << 31);
+    }
+    
+    //the interrupt controller only sees the rising edge of the master flag
+    if(active && !was_active)
+    {
+        m_cpu->raise_irq(CPU::Interrupt::DMA);
+    }
+}
+
+bool DMA::holds_bus() const
+{
+    return m_cpu->m_scheduler.now() < m_bus_release;
+}
+
+template<DMA::DMAChannel channel_type>
+u32 DMA::transfer(DMA::Channel& channel, DMA::Transfer& transfer, u32 budget, bool& done)
+{
     //direct block transfer
     if(channel.sync != Sync::LList)
     {
-        std::printf("DMA Log: Block DMA start - %s\n", channel.mode == Mode::FromRAM ? "From RAM" : "To RAM");
+        u32* ram   = reinterpret_cast<u32*>(m_cpu->m_mmu.m_physical_ram);
+        u32  total = std::min(budget, transfer.remaining);
         
-        u32 base  = channel.base;
-        u32 total = channel.transfer_size();
-        u32 dir   = (channel.direction == Direction::Inc ? 1 : -1) * 4;
-        u32 src;
-        
-        while(total > 0)
+        if(channel.mode == Mode::FromRAM)
         {
-            u32 address = base & 0x1FFFFC;
-            
-            if(channel.mode == Mode::FromRAM)
+            if constexpr (channel_type == DMAChannel::GPU)
             {
-                src = m_cpu->m_mmu.read<u32>(address);
-                
-                if constexpr (channel_type == DMAChannel::GPU)
+                for_each_ram_run(transfer.cursor, total, channel.direction, [&](u32 first, u32 count)
                 {
-                    m_cpu->m_gpu.gp0_exec(src);
-                }
-                else
-                {
-                    assert(false);
-                }
+                    if(channel.direction == Direction::Inc)
+                    {
+                        m_cpu->m_gpu.gp0_write_burst(ram + first, count);
+                    }
+                    else
+                    {
+                        for(u32 i = count; i > 0; i--)
+                        {
+                            m_cpu->m_gpu.set(static_cast<u8>(GPUReg::GP0_READ), ram[first + i - 1]);
+                        }
+                    }
+                });
             }
             else
             {
-                if constexpr (channel_type == DMAChannel::OTC)
+                assert(false);
+            }
+        }
+        else
+        {
+            if constexpr (channel_type == DMAChannel::OTC)
+            {
+                //the ordering table is always built towards lower addresses,
+                //each entry points to the one below it and the last one terminates the list
+                u32 last = 0;
+                
+                for_each_ram_run(transfer.cursor, total, Direction::Dec, [&](u32 first, u32 count)
                 {
-                    if(total == 1)       { src = 0xFFFFFF; }
-                    else { src = (address - 4) & 0x1FFFFF; }
-                }
-                else if constexpr (channel_type == DMAChannel::GPU)
+                    for(u32 i = first; i < first + count; i++)
+                    {
+                        ram[i] = ((i - 1) << 2) & 0x1FFFFF;
+                    }
+                    
+                    m_cpu->m_mmu.mark_ram_dirty(first << 2, count << 2);
+                    last = first;
+                });
+                
+                if(total > 0 && total == transfer.remaining)
                 {
-                    assert(false);
-                    //src = m_cpu->m_gpu.get(static_cast<u8>(GPUReg::GP0_READ));
+                    ram[last] = 0xFFFFFF;
                 }
-                else
+            }
+            else if constexpr (channel_type == DMAChannel::GPU)
+            {
+                for_each_ram_run(transfer.cursor, total, channel.direction, [&](u32 first, u32 count)
                 {
-                    assert(false);
-                }
-                
-                
-                m_cpu->m_mmu.write<u32>(address, src);
+                    if(channel.direction == Direction::Inc)
+                    {
+                        m_cpu->m_gpu.gpuread_burst(ram + first, count);
+                    }
+                    else
+                    {
+                        for(u32 i = count; i > 0; i--)
+                        {
+                            ram[first + i - 1] = m_cpu->m_gpu.get(static_cast<u8>(GPUReg::GP0_READ));
+                        }
+                    }
+                    
+                    m_cpu->m_mmu.mark_ram_dirty(first << 2, count << 2);
+                });
+            }
+            else
+            {
+                assert(false);
             }
-            
-            base += dir;
-            total--;
         }
+        
+        u32 step = (channel_type == DMAChannel::OTC || channel.direction == Direction::Dec) ? -4 : 4;
+        
+        transfer.cursor     = (transfer.cursor + total * step) & 0x1FFFFC;
+        transfer.remaining -= total;
+        
+        m_frame_stats.block_words += total;
+        
+        done = transfer.remaining == 0;
+        
+        return total * WordCycles;
     }
     //transfer blocks within a linked list blocks
     else
     {
-        u32 address = channel.base & 0x1FFFFC;
-        
-        std::printf("DMA Log: LList DMA start\n");
+        u32 cycles = 0;
         
         if(channel.mode == Mode::FromRAM)
         {
             //is linked list gpu only?
             assert(channel_type == DMAChannel::GPU);
             
-            for(;;)
+            const u32* ram = reinterpret_cast<const u32*>(m_cpu->m_mmu.m_physical_ram);
+            
+            u32 walked = 0;
+            
+            //nodes are never split, so a burst ends on the first node boundary past the budget
+            while(walked < budget)
             {
-                u32 header = m_cpu->m_mmu.read<u32>(address);
+                u32 address = transfer.cursor;
+                u32 header  = ram[address >> 2];
+                u32 next    = header & 0x1FFFFC;
+                u32 words   = header >> 24;
                 
-                u32 total = header >> 24;
+                //start pulling in the next node while this one is parsed
+                __builtin_prefetch(ram + (next >> 2));
                 
-                while(total > 0)
+                //hand the whole node payload to the gpu at once
+                for_each_ram_run(address + 4, words, Direction::Inc, [&](u32 first, u32 count)
                 {
-                    address = (address + 4) & 0x1FFFFC;
-                    
-                    u32 cmd = m_cpu->m_mmu.read<u32>(address);
-                    m_cpu->m_gpu.gp0_exec(cmd); //send gpu command to the gpu
-                    total--;
-                }
+                    m_cpu->m_gpu.gp0_write_burst(ram + first, count);
+                });
+                
+                m_frame_stats.llist_nodes++;
+                m_frame_stats.llist_words += words;
+                
+                walked += words + 1;
+                cycles += LListNodeCycles + words * WordCycles;
                 
                 if(header & 0x800000) //0xFFFFFF
                 {
+                    done = true;
                     break;
                 }
                 
-                address = header & 0x1FFFFC;
+                transfer.cursor = next;
+                
+                //a malformed ordering table can loop forever, so a second cursor runs
+                //ahead two nodes per step, if it ever lands on the walker the list is cyclic
+                for(u32 i = 0; i < 2 && !transfer.hare_done; i++)
+                {
+                    u32 hare_header = ram[transfer.hare >> 2];
+                    
+                    if(hare_header & 0x800000)
+                    {
+                        transfer.hare_done = true;
+                    }
+                    
+                    transfer.hare = hare_header & 0x1FFFFC;
+                }
+                
+                if(!transfer.hare_done && transfer.hare == transfer.cursor)
+                {
+                    std::printf("DMA error: linked list loops at 0x%08x, transfer aborted\n", transfer.cursor);
+                    m_frame_stats.llist_aborts++;
+                    done = true;
+                    break;
+                }
             }
         }
         else
         {
             assert(false);
         }
+        
+        return cycles;
     }
-    
-    //TODO: set bits to end transfer
-    channel.enabled = false;
-    channel.trigger = false;
-    
-    //assert(false);
 }
 
-template void DMA::execute<DMA::DMAChannel::MDECIN>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::MDECOUT>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::GPU>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::CDROM>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::SPU>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::PIO>(DMA::Channel& channel);
-template void DMA::execute<DMA::DMAChannel::OTC>(DMA::Channel& channel);
+template u32 DMA::transfer<DMA::DMAChannel::MDECIN>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::MDECOUT>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::GPU>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::CDROM>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::SPU>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::PIO>(DMA::Channel&, DMA::Transfer&, u32, bool&);
+template u32 DMA::transfer<DMA::DMAChannel::OTC>(DMA::Channel&, DMA::Transfer&, u32, bool&);
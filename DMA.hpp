@@ -50,7 +50,6 @@ public:
         
         void base_set(u32 value)
         {
-            std::printf("base: 0x%08x\n", value);
             base = value & 0xFFFFF;
         }
         
@@ -65,7 +64,6 @@ public:
         
         void block_set(u32 value)
         {
-            std::printf("block: 0x%08x\n", value);
             block_words = (value >>  0) & 0xFFFF;
             block_count = (value >> 16) & 0xFFFF;
         }
@@ -95,8 +93,6 @@ public:
             chop_cpu_window = (value >> 20) & 0b111;
             enabled   = (value >> 24) & 1;
             trigger   = (value >> 28) & 1;
-            
-            std::printf("ctrl: 0x%08x, active: %s\n", value, active() ? "true" : "false");
         }
         
         u32 control_get()
@@ -125,8 +121,36 @@ public:
         }
     };
     
+    /**
+     * transfer telemetry, accumulated until take_frame_stats() is called
+     */
+    struct Stats
+    {
+        u32 block_transfers { 0 };
+        u32 block_words     { 0 };
+        u32 llist_transfers { 0 };
+        u32 llist_nodes     { 0 };
+        u32 llist_words     { 0 };
+        u32 llist_aborts    { 0 };
+        u64 cycles          { 0 };
+    };
+    
+    /**
+     * approximate bus cost of a transfer
+     */
+    static constexpr const u32 WordCycles      = 1;
+    static constexpr const u32 LListNodeCycles = 8;
+    
     DMA(CPU* cpu) { m_regs.control = 0x07654321; m_cpu = cpu; }
     
+    const Stats& frame_stats() const { return m_frame_stats; }
+    Stats take_frame_stats()
+    {
+        Stats stats = m_frame_stats;
+        m_frame_stats = Stats();
+        return stats;
+    }
+    
     //control
     u32  control() const { return m_regs.control; }
     
@@ -171,37 +195,21 @@ public:
             u8 channel_index = i / 3;
             if((i % 3) == 0) //alter base
             {
-                std::printf("channel: %hhu - ", channel_index);
                 m_channels[channel_index].base_set(value);
             }
             else if((i % 3) == 1) //alter block
             {
-                std::printf("channel: %hhu - ", channel_index);
                 m_channels[channel_index].block_set(value);
             }
             else if((i % 3) == 2) //alter control
             {
-                std::printf("channel: %hhu - ", channel_index);
                 m_channels[channel_index].control_set(value);
                 
                 //TODO: fire of dma transfer better
                 //      see Nocash: Commonly used DMA Control Register values for starting DMA transfers
                 if(m_channels[channel_index].active())
                 {
-                    switch(channel_index)
-                    {
-                        case 0: { execute<DMAChannel::MDECIN>(m_channels[channel_index]); break; }
-                        case 1: { execute<DMAChannel::MDECOUT>(m_channels[channel_index]); break; }
-                        case 2: { execute<DMAChannel::GPU>(m_channels[channel_index]); break; }
-                        case 3: { execute<DMAChannel::CDROM>(m_channels[channel_index]); break; }
-                        case 4: { execute<DMAChannel::SPU>(m_channels[channel_index]); break; }
-                        case 5: { execute<DMAChannel::PIO>(m_channels[channel_index]); break; }
-                        case 6: { execute<DMAChannel::OTC>(m_channels[channel_index]); break; }
-                        default:
-                        {
-                            assert(false); break;
-                        }
-                    }
+                    start(channel_index);
                 }
             }
             else
@@ -212,19 +220,54 @@ public:
         }
         else
         {
-            m_regs[i - 21] = value;
-            
-            if(static_cast<DMAReg>(i) == DMAReg::INT) //reset channels
+            if(static_cast<DMAReg>(i) == DMAReg::INT)
+            {
+                //channel flags are acknowledged by writing 1, the master flag is recomputed,
+                //it keeps its old value until then so only a real rising edge raises the irq
+                u32 flags  = m_regs.interrupt & ~value & 0x7F000000;
+                u32 master = m_regs.interrupt & 0x80000000;
+                
+                m_regs.interrupt = (value & 0x00FF803F) | flags | master;
+                
+                update_irq();
+            }
+            else
             {
-                m_regs[i - 21] = ((~value) & 0x007F0000) | (m_regs[static_cast<u8>(DMAReg::INT) & ~0x007F0000]);
+                m_regs[i - 21] = value;
             }
         }
     }
     
 protected:
     
+    /**
+     * progress of a running transfer, advanced one burst per scheduler event
+     */
+    struct Transfer
+    {
+        u32  cursor    { 0 };
+        u32  remaining { 0 };
+        
+        //linked list loop detection
+        u32  hare      { 0 };
+        bool hare_done { false };
+    };
+    
+    /**
+     * words moved per scheduler event when the channel isn't chopping
+     */
+    static constexpr const u32 BurstWords = 0x400;
+    
+    void start(u8 channel_index);
+    void step();
+    void finish(u8 channel_index);
+    void update_irq();
+    
+    bool holds_bus() const;
+    u64  bus_release() const { return m_bus_release; }
+    
     template<DMA::DMAChannel channel_type>
-    void execute(Channel&);
+    u32 transfer(Channel&, Transfer&, u32 budget, bool& done);
     
     friend class CPU;
     friend class MMU;
@@ -244,6 +287,11 @@ protected:
         }
     } m_regs;
     
-    Channel m_channels[7];
-    CPU*    m_cpu;
+    Channel  m_channels[7];
+    Transfer m_transfers[7];
+    CPU*     m_cpu;
+    Stats    m_frame_stats;
+    
+    u8  m_running     { 0 }; // mask of channels with a transfer in flight
+    u64 m_bus_release { 0 }; // cycle at which the current burst hands the bus back
 };
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <vector>
+
+/**
+ * per-page dirty bitmap over a block of emulated memory
+ *
+ * every store into the region marks the page it lands in, collect() hands out
+ * the pages written since the last call and starts a new checkpoint
+ */
+template<u32 region_size, u32 page_size>
+class DirtyTracker
+{
+public:
+
+    static_assert(static_is_power_of_two(page_size));
+
+    static constexpr const u32 RegionSize = region_size;
+    static constexpr const u32 PageSize   = page_size;
+    static constexpr const u32 PageCount  = (region_size + page_size - 1) / page_size;
+
+    DirtyTracker() { clear(); }
+
+    /**
+     * mark the page containing offset
+     */
+    void mark(u32 offset)
+    {
+        u32 page = (offset / PageSize) % PageCount;
+        m_bits[page >> 6] |= u64(1) << (page & 63);
+    }
+
+    /**
+     * mark every page touched by [offset, offset + size)
+     */
+    void mark(u32 offset, u32 size)
+    {
+        if(size == 0)
+        {
+            return;
+        }
+
+        if(size >= RegionSize)
+        {
+            mark_all();
+            return;
+        }
+
+        u32 first = offset / PageSize;
+        u32 last  = (offset + size - 1) / PageSize;
+
+        for(u32 page = first; page <= last; page++)
+        {
+            u32 wrapped = page % PageCount;
+            m_bits[wrapped >> 6] |= u64(1) << (wrapped & 63);
+        }
+    }
+
+    void mark_all()
+    {
+        for(u32 i = 0; i < WordCount; i++)
+        {
+            m_bits[i] = ~u64(0);
+        }
+
+        //don't report pages past the end of the region
+        if constexpr ((PageCount & 63) != 0)
+        {
+            m_bits[WordCount - 1] = (u64(1) << (PageCount & 63)) - 1;
+        }
+    }
+
+    void clear()
+    {
+        for(u32 i = 0; i < WordCount; i++)
+        {
+            m_bits[i] = 0;
+        }
+    }
+
+    bool dirty(u32 page) const
+    {
+        assert(page < PageCount);
+        return (m_bits[page >> 6] >> (page & 63)) & 1;
+    }
+
+    bool any() const
+    {
+        for(u32 i = 0; i < WordCount; i++)
+        {
+            if(m_bits[i] != 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * append the indices of dirty pages to pages and clear the bitmap
+     *
+     * @return number of appended pages
+     */
+    u32 collect(std::vector<u32>& pages)
+    {
+        u32 count = 0;
+
+        for(u32 i = 0; i < WordCount; i++)
+        {
+            u64 word = m_bits[i];
+            m_bits[i] = 0;
+
+            while(word != 0)
+            {
+                pages.push_back(i * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    std::vector<u32> collect()
+    {
+        std::vector<u32> pages;
+        collect(pages);
+        return pages;
+    }
+
+private:
+
+    static constexpr const u32 WordCount = (PageCount + 63) / 64;
+
+    u64 m_bits[WordCount];
+};
@@ -189,6 +189,17 @@ int File::read_byte()
     return fgetc(m_file_handle);
 }
 
+/**
+    * push buffered writes out to the file
+    */
+void File::flush()
+{
+    if(m_file_handle != nullptr)
+    {
+        fflush(m_file_handle);
+    }
+}
+
 /**
     * write data itno a file
     */
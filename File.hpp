@@ -94,6 +94,11 @@ public:
         * write 1 byte
         */
     u64 write_byte(u8 byte);
+    
+    /**
+        * push buffered writes out to the file
+        */
+    void flush();
 
     
     /**
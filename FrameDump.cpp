@@ -0,0 +1,471 @@
+#include "FrameDump.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    constexpr const u32 VRAMWidth  = 1024;
+    constexpr const u32 VRAMHeight = 512;
+
+    void put_be32(std::vector<u8>& out, u32 value)
+    {
+        out.push_back(value >> 24);
+        out.push_back(value >> 16);
+        out.push_back(value >>  8);
+        out.push_back(value >>  0);
+    }
+
+    u32 crc32(const u8* data, size_t size)
+    {
+        static const std::array<u32, 256> table = []()
+        {
+            std::array<u32, 256> table;
+
+            for(u32 i = 0; i < 256; i++)
+            {
+                u32 c = i;
+
+                for(u32 k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+
+                table[i] = c;
+            }
+
+            return table;
+        }();
+
+        u32 crc = 0xFFFFFFFF;
+
+        for(size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    /**
+     * PNG chunks are length, type, data, crc of type and data
+     */
+    size_t begin_chunk(std::vector<u8>& out, const char* type)
+    {
+        size_t start = out.size();
+
+        put_be32(out, 0);
+        out.insert(out.end(), type, type + 4);
+
+        return start;
+    }
+
+    void end_chunk(std::vector<u8>& out, size_t start)
+    {
+        u32 length = out.size() - start - 8;
+
+        out[start + 0] = length >> 24;
+        out[start + 1] = length >> 16;
+        out[start + 2] = length >>  8;
+        out[start + 3] = length >>  0;
+
+        put_be32(out, crc32(out.data() + start + 4, length + 4));
+    }
+}
+
+bool FrameDump::open(const char* hash_path, const char* dump_path)
+{
+    close();
+
+    m_frames  = 0;
+    m_dropped = 0;
+
+    if(hash_path != nullptr)
+    {
+        m_hashes.open(hash_path, File::OpenMode::Write);
+        m_hashing = m_hashes.is_file();
+
+        if(!m_hashing)
+        {
+            std::printf("FrameDump::open() warning: can't write %s\n", hash_path);
+        }
+    }
+
+    if(dump_path != nullptr)
+    {
+        m_dump_path = dump_path;
+        m_y4m       = m_dump_path.size() >= 4 && m_dump_path.compare(m_dump_path.size() - 4, 4, ".y4m") == 0;
+
+        if(m_y4m)
+        {
+            m_y4m_file.open(dump_path, File::OpenMode::Write);
+            m_y4m_width  = 0;
+            m_y4m_height = 0;
+            m_y4m_warned = false;
+
+            if(!m_y4m_file.is_file())
+            {
+                std::printf("FrameDump::open() warning: can't write %s\n", dump_path);
+                return enabled();
+            }
+        }
+
+        for(u32 i = 0; i < Slots; i++)
+        {
+            m_free.push(i);
+        }
+
+        m_quit.store(false);
+        m_encoding = true;
+        m_encoder  = std::thread(&FrameDump::encoder_main, this);
+    }
+
+    return enabled();
+}
+
+void FrameDump::close()
+{
+    if(m_encoding)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_quit.store(true);
+        }
+
+        //the encoder finishes whatever is queued before it leaves
+        m_wake.notify_one();
+        m_encoder.join();
+
+        u32 slot;
+
+        while(m_free.pop(&slot, 1) != 0) {}
+        while(m_queued.pop(&slot, 1) != 0) {}
+
+        m_y4m_file.close();
+        m_encoding = false;
+
+        if(m_dropped != 0)
+        {
+            std::printf("FrameDump: the encoder fell behind, %u of %u frames are missing from %s\n", m_dropped, m_frames, m_dump_path.c_str());
+        }
+    }
+
+    m_hashes.close();
+    m_hashing = false;
+}
+
+void FrameDump::capture(const u16* vram, u16 x, u16 y, u16 width, u16 height, bool depth24, bool pal)
+{
+    u32  number = m_frames++;
+    bool shown  = width != 0 && height != 0;
+    u32  slot   = 0;
+
+    //take a free slot or give up on encoding this frame, never wait for one
+    bool queued = m_encoding && shown && m_free.pop(&slot, 1) == 1;
+
+    if(m_encoding && shown && !queued)
+    {
+        m_dropped++;
+    }
+
+    if(!queued && !m_hashing)
+    {
+        return;
+    }
+
+    Frame& frame = queued ? m_slots[slot] : m_scratch;
+
+    frame.number = number;
+    frame.width  = width;
+    frame.height = height;
+    frame.pal    = pal;
+
+    convert(frame.rgb, vram, x, y, width, height, depth24);
+
+    if(m_hashing)
+    {
+        char line[64];
+        int  length = std::snprintf(line, sizeof(line), "%u %016llx %ux%u\n", number,
+                                    static_cast<unsigned long long>(hash(frame.rgb.data(), frame.rgb.size())), width, height);
+
+        m_hashes.write(line, length);
+
+        //the emulator is stopped by closing it, keep every line so far on disk
+        m_hashes.flush();
+    }
+
+    if(queued)
+    {
+        m_queued.push(slot);
+
+        //a busy lock means the encoder is awake or about to poll again anyway
+        std::unique_lock<std::mutex> lock(m_wake_mutex, std::try_to_lock);
+
+        if(lock.owns_lock())
+        {
+            m_wake.notify_one();
+        }
+    }
+}
+
+u64 FrameDump::hash(const u8* data, size_t size)
+{
+    u64 h = 0x9E3779B97F4A7C15 ^ size;
+
+    //8 bytes at a time, multiply and rotate so every input bit reaches every output bit
+    size_t i = 0;
+
+    for(; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        std::memcpy(&word, data + i, sizeof(word));
+
+        h ^= word * 0x87C37B91114253D5;
+        h  = ((h << 31) | (h >> 33)) * 0x4CF5AD432745937F;
+    }
+
+    u64 tail = 0;
+
+    for(u32 shift = 0; i < size; i++, shift += 8)
+    {
+        tail |= u64(data[i]) << shift;
+    }
+
+    h ^= tail * 0x87C37B91114253D5;
+
+    //splitmix64 finalizer
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EB;
+    h ^= h >> 31;
+
+    return h;
+}
+
+void FrameDump::convert(std::vector<u8>& rgb, const u16* vram, u16 x, u16 y, u16 width, u16 height, bool depth24)
+{
+    rgb.resize(width * height * 3);
+
+    u8* out = rgb.data();
+
+    for(u32 row = 0; row < height; row++)
+    {
+        const u16* line = vram + ((y + row) & (VRAMHeight - 1)) * VRAMWidth;
+
+        if(depth24)
+        {
+            //24 bit pixels are packed across the 16 bit VRAM words, 2 pixels to 3 words
+            u32 first = x * 2;
+
+            for(u32 i = 0; i < width * 3u; i++)
+            {
+                u32 byte = first + i;
+                u16 word = line[(byte >> 1) & (VRAMWidth - 1)];
+
+                *out++ = (byte & 1) ? word >> 8 : word & 0xFF;
+            }
+
+            continue;
+        }
+
+        for(u32 column = 0; column < width; column++)
+        {
+            u16 pixel = line[(x + column) & (VRAMWidth - 1)];
+
+            u8 r = (pixel >>  0) & 31;
+            u8 g = (pixel >>  5) & 31;
+            u8 b = (pixel >> 10) & 31;
+
+            *out++ = (r << 3) | (r >> 2);
+            *out++ = (g << 3) | (g >> 2);
+            *out++ = (b << 3) | (b >> 2);
+        }
+    }
+}
+
+void FrameDump::encoder_main()
+{
+    while(true)
+    {
+        u32 slot;
+
+        if(m_queued.pop(&slot, 1) == 0)
+        {
+            if(m_quit.load())
+            {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+
+            //capture() may not get to notify, so never sleep long
+            if(m_queued.empty() && !m_quit.load())
+            {
+                m_wake.wait_for(lock, std::chrono::milliseconds(5));
+            }
+
+            continue;
+        }
+
+        encode(m_slots[slot]);
+        m_free.push(slot);
+    }
+}
+
+void FrameDump::encode(const Frame& frame)
+{
+    if(m_y4m)
+    {
+        write_y4m(frame);
+    }
+    else
+    {
+        write_png(frame);
+    }
+}
+
+void FrameDump::write_y4m(const Frame& frame)
+{
+    //the stream has one size, the first frame picks it
+    if(m_y4m_width == 0)
+    {
+        m_y4m_width  = frame.width;
+        m_y4m_height = frame.height;
+
+        char header[96];
+        int  length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%s Ip A1:1 C444\n",
+                                    frame.width, frame.height, frame.pal ? "50:1" : "60000:1001");
+
+        m_y4m_file.write(header, length);
+    }
+
+    if(frame.width != m_y4m_width || frame.height != m_y4m_height)
+    {
+        if(!m_y4m_warned)
+        {
+            std::printf("FrameDump::write_y4m() warning: display changed to %ux%u, only %ux%u frames are dumped\n",
+                        frame.width, frame.height, m_y4m_width, m_y4m_height);
+            m_y4m_warned = true;
+        }
+
+        return;
+    }
+
+    u32 pixels = frame.width * frame.height;
+
+    m_encoded.resize(6 + pixels * 3);
+    std::memcpy(m_encoded.data(), "FRAME\n", 6);
+
+    u8* luma  = m_encoded.data() + 6;
+    u8* cb    = luma + pixels;
+    u8* cr    = cb   + pixels;
+    const u8* rgb = frame.rgb.data();
+
+    //studio range BT.601, full resolution chroma
+    for(u32 i = 0; i < pixels; i++, rgb += 3)
+    {
+        s32 r = rgb[0];
+        s32 g = rgb[1];
+        s32 b = rgb[2];
+
+        luma[i] = ((  66 * r + 129 * g +  25 * b + 128) >> 8) +  16;
+        cb[i]   = (( -38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+        cr[i]   = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+    }
+
+    m_y4m_file.write(m_encoded);
+    m_y4m_file.flush();
+}
+
+void FrameDump::write_png(const Frame& frame)
+{
+    //every row starts with filter type 0, deflate's stored blocks keep it uncompressed
+    u32 stride = 1 + frame.width * 3;
+
+    m_buffer.resize(stride * frame.height);
+
+    for(u32 row = 0; row < frame.height; row++)
+    {
+        m_buffer[row * stride] = 0;
+        std::memcpy(&m_buffer[row * stride + 1], &frame.rgb[row * frame.width * 3], frame.width * 3);
+    }
+
+    m_encoded.clear();
+
+    static constexpr const u8 Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    m_encoded.insert(m_encoded.end(), Signature, Signature + 8);
+
+    size_t chunk = begin_chunk(m_encoded, "IHDR");
+    put_be32(m_encoded, frame.width);
+    put_be32(m_encoded, frame.height);
+    m_encoded.push_back(8); // bits per channel
+    m_encoded.push_back(2); // RGB
+    m_encoded.push_back(0); // deflate
+    m_encoded.push_back(0); // adaptive filtering
+    m_encoded.push_back(0); // not interlaced
+    end_chunk(m_encoded, chunk);
+
+    chunk = begin_chunk(m_encoded, "IDAT");
+
+    //zlib header, deflate with a 32K window and no compression
+    m_encoded.push_back(0x78);
+    m_encoded.push_back(0x01);
+
+    u32 a = 1;
+    u32 b = 0;
+
+    for(size_t offset = 0; offset < m_buffer.size();)
+    {
+        u32  size  = std::min<size_t>(m_buffer.size() - offset, 0xFFFF);
+        bool final = offset + size == m_buffer.size();
+
+        m_encoded.push_back(final ? 1 : 0);
+        m_encoded.push_back(size & 0xFF);
+        m_encoded.push_back(size >> 8);
+        m_encoded.push_back(~size & 0xFF);
+        m_encoded.push_back((~size >> 8) & 0xFF);
+        m_encoded.insert(m_encoded.end(), m_buffer.begin() + offset, m_buffer.begin() + offset + size);
+
+        //adler32 of the uncompressed bytes, reduced often enough to stay within 32 bits
+        for(u32 i = 0; i < size; i++)
+        {
+            a += m_buffer[offset + i];
+            b += a;
+
+            if((i & 4095) == 4095)
+            {
+                a %= 65521;
+                b %= 65521;
+            }
+        }
+
+        a %= 65521;
+        b %= 65521;
+
+        offset += size;
+    }
+
+    put_be32(m_encoded, (b << 16) | a);
+    end_chunk(m_encoded, chunk);
+
+    chunk = begin_chunk(m_encoded, "IEND");
+    end_chunk(m_encoded, chunk);
+
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "_%06u.png", frame.number);
+
+    File file(m_dump_path + suffix, File::OpenMode::Write);
+
+    if(!file.is_file())
+    {
+        std::printf("FrameDump::write_png() warning: can't write %s%s\n", m_dump_path.c_str(), suffix);
+        return;
+    }
+
+    file.write(m_encoded);
+}
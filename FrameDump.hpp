@@ -0,0 +1,101 @@
+#pragma once
+
+#include "CommandRing.hpp"
+#include "File.hpp"
+#include "Types.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * per vblank capture of the displayed VRAM area
+ *
+ * every frame is hashed on the calling thread and listed in the hash file,
+ * frames are also handed to an encoder thread writing a Y4M stream or
+ * numbered PNGs, when the encoder falls behind frames are dropped from the
+ * dump rather than waited for
+ */
+class FrameDump
+{
+public:
+
+    FrameDump() {}
+   ~FrameDump() { close(); }
+
+    /**
+     * either path may be null, a dump path ending in .y4m is one raw video
+     * stream, anything else is the prefix of one PNG per frame
+     */
+    bool open(const char* hash_path, const char* dump_path);
+    void close();
+
+    bool enabled() const { return m_hashing || m_encoding; }
+
+    /**
+     * convert, hash and queue the displayed area, an empty area is a blanked display
+     */
+    void capture(const u16* vram, u16 x, u16 y, u16 width, u16 height, bool depth24, bool pal);
+
+    /**
+     * 64 bit hash of the RGB bytes, not meant to resist anything but chance
+     */
+    static u64 hash(const u8* data, size_t size);
+    
+    /**
+     * the displayed area as 8 bit RGB triplets, the bytes that are hashed and encoded
+     */
+    static void convert(std::vector<u8>& rgb, const u16* vram, u16 x, u16 y, u16 width, u16 height, bool depth24);
+
+private:
+
+    static constexpr const u32 Slots = 4;
+
+    struct Frame
+    {
+        std::vector<u8> rgb;
+        u32             number { 0 };
+        u16             width  { 0 };
+        u16             height { 0 };
+        bool            pal    { false };
+    };
+
+    void encoder_main();
+    void encode(const Frame& frame);
+    void write_y4m(const Frame& frame);
+    void write_png(const Frame& frame);
+
+    File m_hashes;
+    bool m_hashing  { false };
+    bool m_encoding { false };
+    u32  m_frames   { 0 };
+    u32  m_dropped  { 0 };
+
+    //hash only frames and frames the encoder has no room for are converted here
+    Frame m_scratch;
+
+    //slots travel from the free ring to the queued ring and back again
+    Frame                       m_slots[Slots];
+    CommandRing<u32, Slots * 2> m_free;
+    CommandRing<u32, Slots * 2> m_queued;
+
+    //encoder side
+    std::string m_dump_path;
+    bool        m_y4m        { false };
+    File        m_y4m_file;
+    u16         m_y4m_width  { 0 };
+    u16         m_y4m_height { 0 };
+    bool        m_y4m_warned { false };
+
+    //rows being packed and the encoded file, reused from frame to frame
+    std::vector<u8> m_buffer;
+    std::vector<u8> m_encoded;
+
+    std::thread             m_encoder;
+    std::atomic<bool>       m_quit { false };
+    std::mutex              m_wake_mutex;
+    std::condition_variable m_wake;
+};
@@ -14,14 +14,25 @@
 #include <SDL2/SDL.h>
 #endif
 
+#include <cstring>
+
 /**
  * shared GPU array buffer object
+ *
+ * the buffer stays mapped and is used as a ring of segments: elements are
+ * appended to the current segment in batches, leaving a segment fences it
+ * and entering one waits until the GPU is done reading what it held last
+ * time, so the CPU never writes over vertices a draw still needs
  */
-template<typename T, u32 size>
+template<typename T, u32 size, u32 segments = 3>
 class GLBuffer
 {
 public:
     
+    static_assert(size % segments == 0);
+    
+    static constexpr const u32 SegmentLength = size / segments;
+    
     GLBuffer() {}
     
     void init()
@@ -32,9 +43,10 @@ public:
         glBindBuffer(GL_ARRAY_BUFFER, m_id);
 		glBufferStorage(GL_ARRAY_BUFFER, buffer_size, nullptr, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT);
         
-		m_raw = reinterpret_cast<T*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT));
+        //not coherent, written ranges are flushed by hand before they are drawn
+		m_raw = reinterpret_cast<T*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
 		
-		memset(m_raw, 0, buffer_size);
+		memset(static_cast<void*>(m_raw), 0, buffer_size);
 		
 		m_inited = true;
     }
@@ -53,23 +65,92 @@ public:
     {
 		if(m_inited)
 		{
+            for(GLsync& fence : m_fences)
+            {
+                if(fence != nullptr)
+                {
+                    glDeleteSync(fence);
+                }
+            }
+            
 			glBindBuffer(GL_ARRAY_BUFFER, m_id);
 			glUnmapBuffer(GL_ARRAY_BUFFER);
 			glDeleteBuffers(1, &m_id);
 		}
     }
     
-    T& operator[](u32 index)
+    /**
+     * append to the current batch, check available() first
+     */
+    T& push()
+    {
+        assert(m_cursor < segment_end());
+        return m_raw[m_cursor++];
+    }
+    
+    /**
+     * room left in the current segment
+     */
+    u32 available() const { return segment_end() - m_cursor; }
+    
+    u32 batch_first() const { return m_batch_first; }
+    u32 batch_count() const { return m_cursor - m_batch_first; }
+    
+    /**
+     * make the batch visible to the GPU, call before drawing it
+     */
+    void submit_batch()
+    {
+        if(batch_count() == 0)
+        {
+            return;
+        }
+        
+        glBindBuffer(GL_ARRAY_BUFFER, m_id);
+        glFlushMappedBufferRange(GL_ARRAY_BUFFER, m_batch_first * sizeof(T), batch_count() * sizeof(T));
+        
+        m_batch_first = m_cursor;
+    }
+    
+    /**
+     * fence the current segment behind the draws issued so far and move on to the next one,
+     * the batch must have been submitted
+     */
+    void next_segment()
     {
-        assert(index < size);
-        return m_raw[index];
+        assert(batch_count() == 0);
+        
+        m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        
+        m_segment = (m_segment + 1) % segments;
+        
+        GLsync& fence = m_fences[m_segment];
+        
+        if(fence != nullptr)
+        {
+            while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        
+        m_cursor      = m_segment * SegmentLength;
+        m_batch_first = m_cursor;
     }
     
     GLuint id() const { return m_id; }
     T* data()   const { return m_raw; }
     
 private:
+    
+    u32 segment_end() const { return (m_segment + 1) * SegmentLength; }
+    
     GLuint m_id   { 0 };
     T*     m_raw  { nullptr };
 	bool   m_inited { false };
+    
+    u32    m_segment     { 0 };
+    u32    m_cursor      { 0 };
+    u32    m_batch_first { 0 };
+    GLsync m_fences[segments] {};
 };
@@ -1,7 +1,25 @@
 #include "GPU.hpp"
+#include "CPU.hpp"
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <cstdlib>
 
 void GPU::set(u8 i, u32 value)
 {
+    if(m_capture.recording())
+    {
+        bool gp0 = static_cast<GPUReg>(i) == GPUReg::GP0_READ;
+        
+        m_capture.write(gp0 ? GPUCapture::Record::GP0 : GPUCapture::Record::GP1, cycles(), &value, 1);
+    }
+    
+    if(m_threaded)
+    {
+        submit(static_cast<GPUReg>(i) == GPUReg::GP0_READ ? Command::GP0 : Command::GP1, value);
+        return;
+    }
+    
     switch(static_cast<GPUReg>(i))
     {
         case GPUReg::GP0_READ: { gp0_exec(value); break; }
@@ -20,48 +38,33 @@ u32 GPU::get(u8 i)
     {
         case GPUReg::GP0_READ:
         {
-            //TODO: implement this
-            return 0; break;
+            sync();
+            
+            //the last word stays latched once the readback is drained
+            if(gpuread_pending())
+            {
+                m_gpuread = m_read_fifo[m_read_index++];
+            }
+            
+            if(m_capture.recording())
+            {
+                m_capture.write(GPUCapture::Record::GPURead, cycles(), &m_gpuread, 1);
+            }
+            
+            return m_gpuread; break;
         }
         case GPUReg::GP1_STAT:
         {
-            u32 value =
-            (m_tex_page_base_x << 0) |
-            (m_tex_page_base_y << 4) |
-            (static_cast<u32>(m_semi_transparency) << 5) |
-            (static_cast<u32>(m_tex_depth) << 7) |
-            (m_dithering << 9) |
-            (m_draw_to_display << 10) |
-            (m_force_mask_bit << 11) |
-            (m_preserved_masked_pixels << 12) |
-            (static_cast<u32>(m_field) << 13) |
-            (m_tex_disable << 15) |
-            hres_info_status(m_h_resolution) |
-            //TODO: implement interlace
-            //(static_cast<u32>(m_v_resolution) << 19) |
-            (static_cast<u32>(m_video_mode) << 20) |
-            (static_cast<u32>(m_display_depth) << 21) |
-            (m_v_interlace << 22) |
-            (m_display_disabled << 23) |
-            (m_interrupt << 24) |
-            (1 << 26) |
-            (1 << 27) |
-            (1 << 28) |
-            (static_cast<u32>(m_dma_mode) << 29);
-            
-            switch(m_dma_mode)
+            //without pending GP1 writes the stat published by the gpu thread is good enough,
+            //GP0 state showing up late is no different from commands still sitting in the fifo
+            if(m_threaded && !m_gp1_pending)
             {
-                case DMAMode::Off:       { value |= 0 << 25; break; }
-                case DMAMode::Fifo:      { value |= 1 << 25; break; }
-                case DMAMode::CPUToGP0:  { value |= ((value >> 28) & 1) << 25; break; }
-                case DMAMode::VRAMToCPU: { value |= ((value >> 27) & 1) << 25; break; }
-                default:
-                {
-                    assert(false); break;
-                }
+                return m_stat.load(std::memory_order_acquire);
             }
             
-            return value; break;
+            sync();
+            
+            return gpustat(); break;
         }
             
         default:
@@ -71,14 +74,55 @@ u32 GPU::get(u8 i)
     }
 }
 
-void GPU::gp0_exec(GPUInstruction command)
+u32 GPU::gpustat() const
 {
-    static bool print_args = false;
+    u32 value =
+    (m_tex_page_base_x << 0) |
+    (m_tex_page_base_y << 4) |
+    (static_cast<u32>(m_semi_transparency) << 5) |
+    (static_cast<u32>(m_tex_depth) << 7) |
+    (m_dithering << 9) |
+    (m_draw_to_display << 10) |
+    (m_force_mask_bit << 11) |
+    (m_preserved_masked_pixels << 12) |
+    (static_cast<u32>(m_field) << 13) |
+    (m_tex_disable << 15) |
+    hres_info_status(m_h_resolution) |
+    //TODO: implement interlace
+    //(static_cast<u32>(m_v_resolution) << 19) |
+    (static_cast<u32>(m_video_mode) << 20) |
+    (static_cast<u32>(m_display_depth) << 21) |
+    (m_v_interlace << 22) |
+    (m_display_disabled << 23) |
+    (m_interrupt << 24) |
+    (1 << 26) |
+    (gpuread_pending() << 27) |
+    (1 << 28) |
+    (static_cast<u32>(m_dma_mode) << 29);
     
+    switch(m_dma_mode)
+    {
+        case DMAMode::Off:       { value |= 0 << 25; break; }
+        case DMAMode::Fifo:      { value |= 1 << 25; break; }
+        case DMAMode::CPUToGP0:  { value |= ((value >> 28) & 1) << 25; break; }
+        case DMAMode::VRAMToCPU: { value |= ((value >> 27) & 1) << 25; break; }
+        default:
+        {
+            assert(false); break;
+        }
+    }
+    
+    return value;
+}
+
+void GPU::gp0_exec(GPUInstruction command)
+{
     //GP0_LDIMAGE will modify the m_gp0_mode so that it will calculate m_gp0_remaining_data
     if(m_gp0_mode == GP0Mode::Image)
     {
-        //TODO: copy pixels
+        u16 pixels[2] = { static_cast<u16>(command & 0xFFFF), static_cast<u16>(command >> 16) };
+        
+        image_load(pixels, 2);
         
         m_gp0_remaining_data--;
         
@@ -86,53 +130,992 @@ void GPU::gp0_exec(GPUInstruction command)
         {
             m_gp0_mode = GP0Mode::Command;
         }
+        
+        return;
     }
-    else /* if(m_gp0_mode == GP0Mode::Command) */
+    
+    if(m_gp0_packet == nullptr)
+    {
+        m_gp0_packet         = &GP0Packets[command.op()];
+        m_gp0_remaining_data = m_gp0_packet->length;
+    }
+    else if(m_gp0_polyline_opened && m_gp0_arguments.length() == 2 && (command & 0xF000F000) == 0x50005000)
+    {
+        //games end polylines with 0x55555555, the hardware only looks at these bits and
+        //only where the next vertex (or its colour) would start
+        m_gp0_packet          = nullptr;
+        m_gp0_polyline_opened = false;
+        m_gp0_arguments.clear();
+        return;
+    }
+    
+    m_gp0_arguments.push(command);
+    
+    if(--m_gp0_remaining_data == 0)
+    {
+        gp0_dispatch(command);
+    }
+}
+
+void GPU::gp0_dispatch(GPUInstruction last)
+{
+    const GP0Packet& packet = *m_gp0_packet;
+    
+    (this->*packet.handler)(last);
+    
+    if(!packet.polyline)
     {
-        //load the initial command
-        if(m_gp0_queued_handler == nullptr)
+        m_gp0_packet = nullptr;
+        m_gp0_arguments.clear();
+        return;
+    }
+    
+    //the last vertex of the segment starts the next one, which is then drawn like a plain line:
+    //monochrome [command, vertex], shaded [colour with the opcode, vertex]
+    //words per further vertex: just the vertex, or its colour and the vertex
+    u32 group = packet.length - 2;
+    u32 start[2];
+    
+    if(group == 1)
+    {
+        start[0] = m_gp0_arguments[0];
+        start[1] = m_gp0_arguments[2];
+    }
+    else
+    {
+        start[0] = (m_gp0_arguments[2] & 0x00FFFFFF) | (m_gp0_arguments[0] & 0xFF000000);
+        start[1] = m_gp0_arguments[3];
+    }
+    
+    m_gp0_arguments.assign(start, 2);
+    m_gp0_remaining_data  = group;
+    m_gp0_polyline_opened = true;
+}
+
+void GPU::gp0_exec_burst(const u32* words, size_t count)
+{
+    while(count > 0)
+    {
+        if(m_gp0_mode == GP0Mode::Image)
         {
-            std::printf("GP0 cmd: 0x%08x\n", u32(command));
+            u32 consumed = std::min<size_t>(count, m_gp0_remaining_data);
             
-            const std::pair<OpHandler, u32>& cmd = m_gp0_op_handlers[command.op()];
+            //pixel pairs are packed low half first, which matches the host layout
+            image_load(reinterpret_cast<const u16*>(words), consumed * 2);
             
-            m_gp0_queued_handler = cmd.first;
-            m_gp0_remaining_data = cmd.second;
+            m_gp0_remaining_data -= consumed;
             
-            print_args = m_gp0_remaining_data != 1;
-            
-            //skip loading 1 word commands since it will get passed as an argument to the command
-            if(m_gp0_remaining_data == 1)
+            if(m_gp0_remaining_data == 0)
             {
-                m_gp0_remaining_data--;
+                m_gp0_mode = GP0Mode::Command;
             }
+            
+            words += consumed;
+            count -= consumed;
+            continue;
         }
         
-        //if command has arguments load them one after each other
-        if(m_gp0_remaining_data != 0)
+        //a packet is already partially queued -> finish it word by word
+        if(m_gp0_packet != nullptr)
         {
-            if(print_args)
-                std::printf("GP0 arg: 0x%08x\n", u32(command));
+            gp0_exec(*words);
+            words++;
+            count--;
+            continue;
+        }
+        
+        const GP0Packet& packet = GP0Packets[GPUInstruction(*words).op()];
+        
+        //the packet is split across bursts or open ended -> queue it the slow way
+        if(packet.length > count || packet.polyline)
+        {
+            gp0_exec(*words);
+            words++;
+            count--;
+            continue;
+        }
+        
+        //whole packet is in the burst -> dispatch it directly
+        GPUInstruction last = words[packet.length - 1];
+        
+        m_gp0_arguments.assign(words, packet.length);
+        
+        (this->*packet.handler)(last);
+        m_gp0_arguments.clear();
+        
+        words += packet.length;
+        count -= packet.length;
+    }
+}
+
+void GPU::gp0_write_burst(const u32* words, size_t count)
+{
+    if(m_capture.recording())
+    {
+        m_capture.write(GPUCapture::Record::GP0Burst, cycles(), words, count);
+    }
+    
+    if(!m_threaded)
+    {
+        gp0_exec_burst(words, count);
+        return;
+    }
+    
+    for(size_t i = 0; i < count; i++)
+    {
+        submit(Command::GP0, words[i]);
+    }
+}
+
+void GPU::gpuread_burst(u32* words, u32 count)
+{
+    sync();
+    
+    u32 available = std::min<u32>(count, m_read_fifo.size() - m_read_index);
+    
+    if(available > 0)
+    {
+        std::memcpy(words, m_read_fifo.data() + m_read_index, available * sizeof(u32));
+        
+        m_read_index += available;
+        m_gpuread     = words[available - 1];
+    }
+    
+    //reading past the end keeps returning the latched word
+    for(u32 i = available; i < count; i++)
+    {
+        words[i] = m_gpuread;
+    }
+    
+    if(m_capture.recording())
+    {
+        m_capture.write(GPUCapture::Record::GPURead, cycles(), words, count);
+    }
+}
+
+void GPU::image_load(const u16* pixels, u32 count)
+{
+    while(count > 0 && m_image_load.row < m_image_load.height)
+    {
+        u16 y = (m_image_load.y + m_image_load.row) & (VRAMHeight - 1);
+        
+        //whole rows straight from the source when nothing is buffered
+        if(m_image_load.fill == 0 && count >= m_image_load.width)
+        {
+            vram_write_row(m_image_load.x, y, pixels, m_image_load.width);
             
-            m_gp0_arguments.push(command);
-            m_gp0_remaining_data--;
+            pixels += m_image_load.width;
+            count  -= m_image_load.width;
+            m_image_load.row++;
+            continue;
         }
         
+        u32 chunk = std::min<u32>(count, m_image_load.width - m_image_load.fill);
         
-        //we are done loading arguments -> run the command
-        if(m_gp0_remaining_data == 0)
+        std::memcpy(m_image_load.pixels + m_image_load.fill, pixels, chunk * sizeof(u16));
+        
+        pixels += chunk;
+        count  -= chunk;
+        m_image_load.fill += chunk;
+        
+        if(m_image_load.fill == m_image_load.width)
+        {
+            vram_write_row(m_image_load.x, y, m_image_load.pixels, m_image_load.width);
+            
+            m_image_load.fill = 0;
+            m_image_load.row++;
+        }
+    }
+    
+    //anything past the last row is the padding half of the final word
+}
+
+void GPU::vram_write_row(u16 x, u16 y, const u16* pixels, u16 width)
+{
+    //rows wrap around at the right edge of VRAM
+    u16 first_width  = std::min<u32>(width, VRAMWidth - x);
+    u16 second_width = width - first_width;
+    
+    u16* first_row  = &m_vram[y][x];
+    u16* second_row = &m_vram[y][0];
+    
+    if(m_preserved_masked_pixels)
+    {
+        //pixels with the mask bit set are write protected
+        u16 mask = m_force_mask_bit ? 0x8000 : 0;
+        
+        for(u16 i = 0; i < width; i++)
+        {
+            u16& destination = i < first_width ? first_row[i] : second_row[i - first_width];
+            
+            if(!(destination & 0x8000))
+            {
+                destination = pixels[i] | mask;
+            }
+        }
+    }
+    else if(m_force_mask_bit)
+    {
+        for(u16 i = 0; i < first_width; i++)
+        {
+            first_row[i] = pixels[i] | 0x8000;
+        }
+        for(u16 i = 0; i < second_width; i++)
         {
-            (this->*m_gp0_queued_handler)(command);
-            m_gp0_queued_handler = nullptr;
-            m_gp0_arguments.clear();
+            second_row[i] = pixels[first_width + i] | 0x8000;
         }
     }
+    else
+    {
+        std::memcpy(first_row, pixels, first_width * sizeof(u16));
+        std::memcpy(second_row, pixels + first_width, second_width * sizeof(u16));
+    }
+    
+    m_vram_dirty.mark((y * VRAMWidth + x) * sizeof(u16), first_width * sizeof(u16));
+    m_vram_dirty.mark(y * VRAMWidth * sizeof(u16), second_width * sizeof(u16));
+    
+    if(m_renderer)
+    {
+        m_renderer->write_vram(x, y, first_width, 1);
+        m_renderer->write_vram(0, y, second_width, 1);
+    }
 }
 
 void GPU::gp1_exec(GPUInstruction command)
 {
-    std::printf("GP1 cmd: 0x%08x\n", u32(command));
-    (this->*m_gp1_op_handlers[command.op()])(command);
+    (this->*GP1Handlers[command.op()])(command);
+}
+
+void GPU::configure(const Config& config)
+{
+    m_renderer_type = config.renderer;
+    
+    if(m_renderer_type == Config::RendererType::Software)
+    {
+        m_software_renderer.set_threads(config.render_threads);
+    }
+    
+    //headless software and null runs never touch SDL or OpenGL
+    if(m_renderer_type == Config::RendererType::OpenGL || !config.headless)
+    {
+        //the renderer builds its programs as soon as it exists
+        ShaderProgram::set_cache_directory(config.shader_cache_path);
+        
+        m_renderer = std::make_unique<Renderer>(640, 480, config.headless);
+        m_renderer->attach_vram(&m_vram[0][0]);
+        
+        m_renderer->set_frame_pacing(config.pacing);
+        m_renderer->set_resolution_scale(config.resolution_scale);
+        
+        if(config.benchmark_frames != 0)
+        {
+            m_renderer->start_scale_benchmark(config.benchmark_frames);
+        }
+    }
+    
+    if(config.capture_path != nullptr)
+    {
+        m_capture.open(config.capture_path);
+    }
+    
+    if(config.frame_hash_path != nullptr || config.frame_dump_path != nullptr)
+    {
+        m_frame_dump.open(config.frame_hash_path, config.frame_dump_path);
+    }
+    
+    if(config.gpu_thread)
+    {
+        start_thread();
+    }
+}
+
+u64 GPU::cycles() const
+{
+    //gpu_replay runs without a cpu and never records
+    assert(m_cpu != nullptr);
+    
+    return m_cpu->m_scheduler.now();
+}
+
+u32 GPU::frame_cycles() const
+{
+    //the gpu thread owns the display mode, its published GPUSTAT has it too
+    bool pal = m_threaded ? (m_stat.load(std::memory_order_acquire) >> 20) & 1 : m_video_mode == VideoMode::PAL;
+    
+    //59.826Hz and 49.761Hz
+    if(pal)
+    {
+        return u64(Scheduler::ClockRate) * 1000 / 49761;
+    }
+    
+    return u64(Scheduler::ClockRate) * 1000 / 59826;
+}
+
+void GPU::vblank()
+{
+    if(m_capture.recording())
+    {
+        m_capture.write(GPUCapture::Record::VBlank, cycles(), nullptr, 0);
+    }
+    
+    if(m_threaded)
+    {
+        submit(Command::VBlank, 0);
+        return;
+    }
+    
+    present();
+}
+
+void GPU::present()
+{
+    u16 width  = 0;
+    u16 height = 0;
+    
+    //a disabled display shows an empty area
+    if(!m_display_disabled)
+    {
+        //the horizontal range is in dot clock ticks, the divider depends on the resolution
+        static constexpr const u16 dividers[4] = { 10, 8, 5, 4 };
+        static constexpr const u16 widths[4]   = { 256, 320, 512, 640 };
+        
+        bool h368    = m_h_resolution & 1;
+        u16  divider = h368 ? 7   : dividers[m_h_resolution >> 1];
+        u16  nominal = h368 ? 368 : widths[m_h_resolution >> 1];
+        
+        width  = ((std::max(m_display_h_end - m_display_h_start, 0) / divider) + 2) & ~3;
+        height = std::max(m_display_v_end - m_display_v_start, 0);
+        
+        if(width == 0)
+        {
+            width = nominal;
+        }
+        
+        width = std::min(width, nominal);
+        
+        if(m_v_interlace && m_v_resolution == VResolution::Res480ScanLines)
+        {
+            height *= 2;
+        }
+    }
+    
+    if(m_frame_dump.enabled())
+    {
+        dump_frame(width, height);
+    }
+    
+    //nothing to show it on, the frame still ends up in VRAM
+    if(!m_renderer)
+    {
+        m_software_renderer.flush();
+        return;
+    }
+    
+    //software output goes up with the VRAM upload
+    m_software_renderer.flush();
+    upload_software_rows();
+    m_renderer->present(m_display_vram_x_start, m_display_vram_y_start, width, height, m_display_depth == DisplayDepth::Depth24Bits);
+}
+
+void GPU::dump_frame(u16 width, u16 height)
+{
+    width  = std::min<u16>(width,  VRAMWidth);
+    height = std::min<u16>(height, VRAMHeight);
+    
+    bool depth24 = m_display_depth == DisplayDepth::Depth24Bits;
+    
+    //the dump reads the emulated VRAM, OpenGL hands back just the displayed area
+    if(m_renderer_type == Config::RendererType::OpenGL && width != 0 && height != 0)
+    {
+        u16 words = depth24 ? std::min<u32>((width * 3 + 1) / 2 + 1, VRAMWidth) : width;
+        
+        m_renderer->download_vram(m_display_vram_x_start, m_display_vram_y_start, words, height, &m_vram[0][0]);
+    }
+    else
+    {
+        m_software_renderer.flush();
+    }
+    
+    m_frame_dump.capture(&m_vram[0][0], m_display_vram_x_start, m_display_vram_y_start, width, height, depth24, m_video_mode == VideoMode::PAL);
+}
+
+void GPU::start_thread()
+{
+    //the renderer is created on this thread, the gpu thread takes its context and this one keeps the window events
+    if(m_renderer)
+    {
+        m_renderer->set_event_polling(false);
+        m_renderer->release_context();
+    }
+    
+    m_stat.store(gpustat());
+    m_quit.store(false);
+    m_threaded = true;
+    m_thread   = std::thread(&GPU::thread_main, this);
+}
+
+void GPU::stop_thread()
+{
+    if(!m_threaded)
+    {
+        return;
+    }
+    
+    sync();
+    
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_quit.store(true);
+    }
+    
+    m_wake.notify_one();
+    m_thread.join();
+    
+    m_threaded = false;
+    
+    if(m_renderer)
+    {
+        m_renderer->acquire_context();
+        m_renderer->set_event_polling(true);
+    }
+}
+
+void GPU::submit(Command command, u32 word)
+{
+    while(!m_commands.push({ word, command }))
+    {
+        //the gpu thread is a whole ring behind, let it catch up
+        std::this_thread::yield();
+    }
+    
+    m_submitted++;
+    m_gp1_pending |= command == Command::GP1;
+    
+    //pairs with the fence in thread_main() so that either the push or the idle flag is seen
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    if(m_idle.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_wake.notify_one();
+    }
+    
+    if(m_renderer)
+    {
+        m_renderer->poll_events_after_present();
+    }
+}
+
+void GPU::sync()
+{
+    if(!m_threaded)
+    {
+        return;
+    }
+    
+    while(m_retired.load(std::memory_order_acquire) != m_submitted)
+    {
+        std::this_thread::yield();
+    }
+    
+    m_gp1_pending = false;
+}
+
+void GPU::thread_main()
+{
+    if(m_renderer)
+    {
+        m_renderer->acquire_context();
+    }
+    
+    static PortWrite batch[1024];
+    static u32       words[1024];
+    
+    u32 spins = 0;
+    
+    while(!m_quit.load(std::memory_order_relaxed))
+    {
+        u32 count = m_commands.pop(batch, 1024);
+        
+        if(count == 0)
+        {
+            //spin a little before going to sleep, commands tend to come in bursts
+            if(++spins < IdleSpins)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            
+            m_idle.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            
+            if(m_commands.empty() && !m_quit.load(std::memory_order_relaxed))
+            {
+                m_wake.wait_for(lock, std::chrono::milliseconds(1));
+            }
+            
+            m_idle.store(false, std::memory_order_relaxed);
+            spins = 0;
+            continue;
+        }
+        
+        spins = 0;
+        
+        for(u32 i = 0; i < count;)
+        {
+            if(batch[i].command == Command::GP1)
+            {
+                gp1_exec(batch[i++].word);
+                continue;
+            }
+            
+            if(batch[i].command == Command::VBlank)
+            {
+                present();
+                i++;
+                continue;
+            }
+            
+            //runs of GP0 words take the burst path
+            u32 run = 0;
+            
+            while(i < count && batch[i].command == Command::GP0)
+            {
+                words[run++] = batch[i++].word;
+            }
+            
+            gp0_exec_burst(words, run);
+        }
+        
+        m_stat.store(gpustat(), std::memory_order_release);
+        m_retired.fetch_add(count, std::memory_order_release);
+    }
+    
+    if(m_renderer)
+    {
+        m_renderer->release_context();
+    }
+}
+
+//the gpu skips triangles 1024 or more pixels wide or 512 or more tall, like SoftwareRenderer::rasterize_triangle
+static bool drawable(const SoftwareRenderer::Vertex& a, const SoftwareRenderer::Vertex& b, const SoftwareRenderer::Vertex& c)
+{
+    return std::max({ a.x, b.x, c.x }) - std::min({ a.x, b.x, c.x }) < 1024 &&
+           std::max({ a.y, b.y, c.y }) - std::min({ a.y, b.y, c.y }) < 512;
+}
+
+void GPU::draw_polygon()
+{
+    u32 command = m_gp0_arguments[0];
+    u8  op      = command >> 24;
+    
+    //polygon opcodes are a bit field
+    bool gouraud  = op & 0x10;
+    bool quad     = op & 0x08;
+    bool textured = op & 0x04;
+    bool semi     = op & 0x02;
+    bool raw      = op & 0x01;
+    
+    u32 vertex_count = quad ? 4 : 3;
+    
+    SoftwareRenderer::Vertex vertices[4];
+    
+    u16 clut    = 0;
+    u16 texpage = 0;
+    u32 index   = 1;
+    
+    //color0+command, vertex0, [uv0+clut], [color1], vertex1, [uv1+texpage], ...
+    for(u32 i = 0; i < vertex_count; i++)
+    {
+        u32 color    = (i != 0 && gouraud) ? u32(m_gp0_arguments[index++]) : command;
+        u32 position = m_gp0_arguments[index++];
+        
+        SoftwareRenderer::Vertex& vertex = vertices[i];
+        
+        //coordinates are signed 11 bit
+        vertex.x = (static_cast<s32>(position << 21) >> 21) + m_drawing_x_offset;
+        vertex.y = (static_cast<s32>(position <<  5) >> 21) + m_drawing_y_offset;
+        vertex.r = (color >>  0) & 0xFF;
+        vertex.g = (color >>  8) & 0xFF;
+        vertex.b = (color >> 16) & 0xFF;
+        
+        if(textured)
+        {
+            u32 uv = m_gp0_arguments[index++];
+            
+            vertex.u = (uv >> 0) & 0xFF;
+            vertex.v = (uv >> 8) & 0xFF;
+            
+            if(i == 0) { clut    = uv >> 16; }
+            if(i == 1) { texpage = uv >> 16; }
+        }
+    }
+    
+    //textured polygons carry their own texture page
+    if(textured)
+    {
+        m_tex_page_base_x   = (texpage >> 0) & 0b1111;
+        m_tex_page_base_y   = (texpage >> 4) & 1;
+        m_semi_transparency = static_cast<Transparency>((texpage >> 5) & 0b11);
+        m_tex_depth         = static_cast<TexDepth>((texpage >> 7) & 0b11);
+    }
+    
+    if(m_renderer_type == Config::RendererType::Null)
+    {
+        return;
+    }
+    
+    if(m_renderer_type == Config::RendererType::Software)
+    {
+        u8 flags = (gouraud  ? SoftwareRenderer::Gouraud         : 0) |
+                   (textured ? SoftwareRenderer::Textured        : 0) |
+                   (textured && raw ? SoftwareRenderer::RawTexture : 0) |
+                   (semi     ? SoftwareRenderer::SemiTransparent : 0);
+        
+        SoftwareRenderer::State state = software_state(clut);
+        
+        if(quad)
+        {
+            m_software_renderer.draw_quad(vertices, flags, state);
+        }
+        else
+        {
+            const SoftwareRenderer::Vertex triangle[3] = { vertices[0], vertices[1], vertices[2] };
+            
+            m_software_renderer.draw_triangle(triangle, flags, state);
+        }
+        
+        software_drawn(std::min({ vertices[0].y, vertices[1].y, vertices[2].y, quad ? vertices[3].y : vertices[0].y }),
+                       std::max({ vertices[0].y, vertices[1].y, vertices[2].y, quad ? vertices[3].y : vertices[0].y }), state);
+    }
+    else
+    {
+        //a quad is two triangles which are rejected one by one
+        bool first  = drawable(vertices[0], vertices[1], vertices[2]);
+        bool second = quad && drawable(vertices[1], vertices[2], vertices[3]);
+        
+        if(!first && !second)
+        {
+            return;
+        }
+        
+        SoftwareRenderer::State software = software_state(clut);
+        Renderer::DrawState     state    = draw_state(software, semi, gouraud || (textured && !raw));
+        
+        //the page and blend mode are part of the vertex, switching them doesn't break the batch
+        u16 page  = textured ? m_renderer->texture_page(software.texpage_x, software.texpage_y, software.tex_depth, software.clut_x, software.clut_y) : 0;
+        u8  blend = blend_flags(software, semi);
+        
+        Renderer::Vertex packed[4];
+        
+        for(u32 i = 0; i < vertex_count; i++)
+        {
+            Renderer::Vertex& vertex = packed[i];
+            
+            vertex.x = static_cast<s16>(vertices[i].x);
+            vertex.y = static_cast<s16>(vertices[i].y);
+            vertex.r = vertices[i].r;
+            vertex.g = vertices[i].g;
+            vertex.b = vertices[i].b;
+            vertex.u = vertices[i].u;
+            vertex.v = vertices[i].v;
+            
+            vertex.flags = blend;
+            
+            if(textured)
+            {
+                vertex.flags |= Renderer::Vertex::Textured | (raw ? Renderer::Vertex::RawTexture : 0);
+                vertex.page  = page;
+                
+                vertex.window_mask_x   = software.tex_window_x_mask;
+                vertex.window_mask_y   = software.tex_window_y_mask;
+                vertex.window_offset_x = software.tex_window_x_offset;
+                vertex.window_offset_y = software.tex_window_y_offset;
+            }
+        }
+        
+        if(first && second)
+        {
+            m_renderer->draw_quad(packed, state);
+        }
+        else
+        {
+            u32 base = first ? 0 : 1;
+            
+            const Renderer::Vertex triangle[3] = { packed[base], packed[base + 1], packed[base + 2] };
+            
+            m_renderer->draw_triangle(triangle, state);
+        }
+    }
+}
+
+void GPU::draw_line()
+{
+    u32 command = m_gp0_arguments[0];
+    u8  op      = command >> 24;
+    
+    bool gouraud = op & 0x10;
+    bool semi    = op & 0x02;
+    
+    SoftwareRenderer::Vertex vertices[2];
+    
+    u32 index = 1;
+    
+    //color0+command, vertex0, [color1], vertex1, polylines come in here a segment at a time
+    for(u32 i = 0; i < 2; i++)
+    {
+        u32 color    = (i != 0 && gouraud) ? u32(m_gp0_arguments[index++]) : command;
+        u32 position = m_gp0_arguments[index++];
+        
+        SoftwareRenderer::Vertex& vertex = vertices[i];
+        
+        vertex.x = (static_cast<s32>(position << 21) >> 21) + m_drawing_x_offset;
+        vertex.y = (static_cast<s32>(position <<  5) >> 21) + m_drawing_y_offset;
+        vertex.r = (color >>  0) & 0xFF;
+        vertex.g = (color >>  8) & 0xFF;
+        vertex.b = (color >> 16) & 0xFF;
+    }
+    
+    //the gpu skips lines which are too long
+    if(std::abs(vertices[1].x - vertices[0].x) >= 1024 || std::abs(vertices[1].y - vertices[0].y) >= 512 ||
+       m_renderer_type == Config::RendererType::Null)
+    {
+        return;
+    }
+    
+    SoftwareRenderer::State software = software_state(0);
+    
+    if(m_renderer_type == Config::RendererType::Software)
+    {
+        u8 flags = (gouraud ? SoftwareRenderer::Gouraud         : 0) |
+                   (semi    ? SoftwareRenderer::SemiTransparent : 0);
+        
+        m_software_renderer.draw_line(vertices, flags, software);
+        
+        software_drawn(std::min(vertices[0].y, vertices[1].y), std::max(vertices[0].y, vertices[1].y), software);
+        return;
+    }
+    
+    Renderer::Line line;
+    
+    line.from.x = static_cast<s16>(vertices[0].x);
+    line.from.y = static_cast<s16>(vertices[0].y);
+    line.from.r = vertices[0].r;
+    line.from.g = vertices[0].g;
+    line.from.b = vertices[0].b;
+    
+    line.from.flags = blend_flags(software, semi);
+    
+    line.to.x = static_cast<s16>(vertices[1].x);
+    line.to.y = static_cast<s16>(vertices[1].y);
+    line.to.r = gouraud ? vertices[1].r : vertices[0].r;
+    line.to.g = gouraud ? vertices[1].g : vertices[0].g;
+    line.to.b = gouraud ? vertices[1].b : vertices[0].b;
+    
+    m_renderer->draw_line(line, draw_state(software, semi, gouraud));
+}
+
+void GPU::draw_rectangle()
+{
+    u32 command = m_gp0_arguments[0];
+    u8  op      = command >> 24;
+    
+    bool textured = op & 0x04;
+    bool semi     = op & 0x02;
+    bool raw      = op & 0x01;
+    
+    SoftwareRenderer::Vertex origin;
+    
+    u32 position = m_gp0_arguments[1];
+    
+    origin.x = (static_cast<s32>(position << 21) >> 21) + m_drawing_x_offset;
+    origin.y = (static_cast<s32>(position <<  5) >> 21) + m_drawing_y_offset;
+    origin.r = (command >>  0) & 0xFF;
+    origin.g = (command >>  8) & 0xFF;
+    origin.b = (command >> 16) & 0xFF;
+    
+    u16 clut  = 0;
+    u32 index = 2;
+    
+    //color+command, vertex, [uv+clut], [size], the page comes from GP0_DRAWMODE
+    if(textured)
+    {
+        u32 uv = m_gp0_arguments[index++];
+        
+        origin.u = (uv >> 0) & 0xFF;
+        origin.v = (uv >> 8) & 0xFF;
+        clut     = uv >> 16;
+    }
+    
+    s32 width;
+    s32 height;
+    
+    switch((op >> 3) & 3)
+    {
+        case 0:
+        {
+            u32 size = m_gp0_arguments[index];
+            
+            width  = (size >>  0) & 0x3FF;
+            height = (size >> 16) & 0x1FF;
+            break;
+        }
+        case 1:  { width = height =  1; break; }
+        case 2:  { width = height =  8; break; }
+        default: { width = height = 16; break; }
+    }
+    
+    if(width == 0 || height == 0 || m_renderer_type == Config::RendererType::Null)
+    {
+        return;
+    }
+    
+    SoftwareRenderer::State software = software_state(clut);
+    
+    if(m_renderer_type == Config::RendererType::Software)
+    {
+        u8 flags = (textured ? SoftwareRenderer::Textured        : 0) |
+                   (textured && raw ? SoftwareRenderer::RawTexture : 0) |
+                   (semi     ? SoftwareRenderer::SemiTransparent : 0) |
+                   (m_rect_tex_x_flip ? SoftwareRenderer::FlipX : 0) |
+                   (m_rect_tex_y_flip ? SoftwareRenderer::FlipY : 0);
+        
+        m_software_renderer.draw_rectangle(origin, width, height, flags, software);
+        
+        software_drawn(origin.y, origin.y + height - 1, software);
+        return;
+    }
+    
+    Renderer::Sprite sprite;
+    
+    sprite.origin.x = static_cast<s16>(origin.x);
+    sprite.origin.y = static_cast<s16>(origin.y);
+    sprite.origin.r = origin.r;
+    sprite.origin.g = origin.g;
+    sprite.origin.b = origin.b;
+    sprite.origin.u = origin.u;
+    sprite.origin.v = origin.v;
+    sprite.width    = width;
+    sprite.height   = height;
+    
+    sprite.origin.flags = blend_flags(software, semi);
+    
+    if(textured)
+    {
+        sprite.origin.flags |= Renderer::Vertex::Textured                           |
+                               (raw               ? Renderer::Vertex::RawTexture : 0) |
+                               (m_rect_tex_x_flip ? Renderer::Vertex::FlipX      : 0) |
+                               (m_rect_tex_y_flip ? Renderer::Vertex::FlipY      : 0);
+        
+        sprite.origin.page = m_renderer->texture_page(software.texpage_x, software.texpage_y, software.tex_depth, software.clut_x, software.clut_y);
+        
+        sprite.origin.window_mask_x   = software.tex_window_x_mask;
+        sprite.origin.window_mask_y   = software.tex_window_y_mask;
+        sprite.origin.window_offset_x = software.tex_window_x_offset;
+        sprite.origin.window_offset_y = software.tex_window_y_offset;
+    }
+    
+    //rectangles are never dithered
+    m_renderer->draw_rectangle(sprite, draw_state(software, semi, false));
+}
+
+u8 GPU::blend_flags(const SoftwareRenderer::State& software, bool semi) const
+{
+    u8 flags = software.force_mask ? Renderer::Vertex::ForceMask : 0;
+    
+    if(semi)
+    {
+        flags |= Renderer::Vertex::SemiTransparent | (software.semi_transparency << Renderer::Vertex::BlendShift);
+    }
+    
+    return flags;
+}
+
+Renderer::DrawState GPU::draw_state(const SoftwareRenderer::State& software, bool semi, bool dither) const
+{
+    Renderer::DrawState state;
+    
+    //dither says whether this kind of primitive would be dithered, the E1 bit whether anything is
+    state.dither      = dither && software.dithering;
+    state.subtract    = semi && software.semi_transparency == Renderer::Vertex::Subtract;
+    state.check_mask  = software.check_mask;
+    state.clip_left   = software.clip_left;
+    state.clip_top    = software.clip_top;
+    state.clip_right  = software.clip_right;
+    state.clip_bottom = software.clip_bottom;
+    
+    return state;
+}
+
+void GPU::software_drawn(s32 top, s32 bottom, const SoftwareRenderer::State& state)
+{
+    //whole rows of the drawing area which the primitive may have touched
+    top    = std::max<s32>(top,    state.clip_top);
+    bottom = std::min<s32>(bottom, state.clip_bottom);
+    
+    if(top <= bottom)
+    {
+        m_vram_dirty.mark(top * VRAMWidth * sizeof(u16), (bottom - top + 1) * VRAMWidth * sizeof(u16));
+        
+        //overlapping primitives share rows, they are only uploaded once at present
+        if(m_renderer)
+        {
+            std::fill(&m_software_rows[top], &m_software_rows[bottom + 1], true);
+        }
+    }
+}
+
+void GPU::upload_software_rows()
+{
+    for(u32 top = 0; top < VRAMHeight; top++)
+    {
+        if(!m_software_rows[top])
+        {
+            continue;
+        }
+        
+        u32 bottom = top;
+        
+        while(bottom + 1 < VRAMHeight && m_software_rows[bottom + 1])
+        {
+            bottom++;
+        }
+        
+        m_renderer->write_vram(0, top, VRAMWidth, bottom - top + 1);
+        std::fill(&m_software_rows[top], &m_software_rows[bottom + 1], false);
+        
+        top = bottom;
+    }
+}
+
+SoftwareRenderer::State GPU::software_state(u16 clut) const
+{
+    SoftwareRenderer::State state;
+    
+    state.clip_left   = m_drawing_area_left;
+    state.clip_top    = m_drawing_area_top;
+    state.clip_right  = std::min<u32>(m_drawing_area_right,  VRAMWidth  - 1);
+    state.clip_bottom = std::min<u32>(m_drawing_area_bottom, VRAMHeight - 1);
+    
+    state.texpage_x = m_tex_page_base_x * 64;
+    state.texpage_y = m_tex_page_base_y * 256;
+    state.tex_depth = static_cast<u8>(m_tex_depth);
+    state.clut_x    = (clut & 0x3F) * 16;
+    state.clut_y    = (clut >> 6) & 0x1FF;
+    
+    state.tex_window_x_mask   = m_tex_window_x_mask;
+    state.tex_window_y_mask   = m_tex_window_y_mask;
+    state.tex_window_x_offset = m_tex_window_x_offset;
+    state.tex_window_y_offset = m_tex_window_y_offset;
+    
+    state.semi_transparency = static_cast<u8>(m_semi_transparency);
+    state.dithering         = m_dithering;
+    state.force_mask        = m_force_mask_bit;
+    state.check_mask        = m_preserved_masked_pixels;
+    
+    return state;
 }
 
 #define UNIPLEMENTED_GP0_INSTRUCTION() std::printf("GPU error: uniplemented GP0 instruction 0x%08x\n", ins.raw()); assert(false);
@@ -161,132 +1144,68 @@ void GPU::GP0_TEXWIN(GPUInstruction& ins)
 }
 void GPU::GP0_MONOQUAD(GPUInstruction&)
 {
-    Renderer::Vertex vertices[4] =
-    {
-        Renderer::Vertex(m_gp0_arguments[1]),
-        Renderer::Vertex(m_gp0_arguments[2]),
-        Renderer::Vertex(m_gp0_arguments[3]),
-		Renderer::Vertex(m_gp0_arguments[4])
-    };
-    
-    Renderer::Color colors[4] =
-    {
-        Renderer::Color(m_gp0_arguments[0]),
-        Renderer::Color(m_gp0_arguments[0]),
-        Renderer::Color(m_gp0_arguments[0]),
-		Renderer::Color(m_gp0_arguments[0])
-    };
-    
-    m_renderer.draw_shaded_quad(vertices, colors);
+    draw_polygon();
 }
 void GPU::GP0_TEXBLENDQUAD(GPUInstruction&)
 {
-    std::printf("GPU Warning: Draw Textured Quad With Blending unimplemented\n");
-	
-	Renderer::Vertex vertices[4] =
-    {
-        Renderer::Vertex(m_gp0_arguments[1]),
-        Renderer::Vertex(m_gp0_arguments[3]),
-        Renderer::Vertex(m_gp0_arguments[5]),
-		Renderer::Vertex(m_gp0_arguments[7])
-    };
-    
-    Renderer::Color colors[4] =
-    {
-        Renderer::Color(0x80, 0, 0),
-        Renderer::Color(0x80, 0, 0),
-        Renderer::Color(0x80, 0, 0),
-		Renderer::Color(0x80, 0, 0)
-    };
-    
-    m_renderer.draw_shaded_quad(vertices, colors);
+    draw_polygon();
 }
 void GPU::GP0_SHADTRI(GPUInstruction&)
 {
-    Renderer::Vertex vertices[3] =
-    {
-        Renderer::Vertex(m_gp0_arguments[1]),
-        Renderer::Vertex(m_gp0_arguments[3]),
-        Renderer::Vertex(m_gp0_arguments[5])
-    };
-    
-    Renderer::Color colors[3] =
-    {
-        Renderer::Color(m_gp0_arguments[0]),
-        Renderer::Color(m_gp0_arguments[2]),
-        Renderer::Color(m_gp0_arguments[4])
-    };
-    
-    m_renderer.draw_shaded_triangle(vertices, colors);
+    draw_polygon();
 }
 void GPU::GP0_SHADQUAD(GPUInstruction&)
 {
-    Renderer::Vertex vertices[4] =
-    {
-        Renderer::Vertex(m_gp0_arguments[1]),
-        Renderer::Vertex(m_gp0_arguments[3]),
-        Renderer::Vertex(m_gp0_arguments[5]),
-		Renderer::Vertex(m_gp0_arguments[7])
-    };
-    
-    Renderer::Color colors[4] =
-    {
-        Renderer::Color(m_gp0_arguments[0]),
-        Renderer::Color(m_gp0_arguments[2]),
-        Renderer::Color(m_gp0_arguments[4]),
-		Renderer::Color(m_gp0_arguments[6])
-    };
-    
-    m_renderer.draw_shaded_quad(vertices, colors);
-}
-void GPU::GP0_MONOTRI(GPUInstruction&) { } // draw monochrome triangle
-void GPU::GP0_MONOTRANSTRI(GPUInstruction&) { } // draw transparent monochrome triangle
-void GPU::GP0_MONOTRANSQUAD(GPUInstruction&) { } // draw transparent monochrome quadrilateral
-void GPU::GP0_TEXBLENDTRI(GPUInstruction&) { } // draw textured triangle with blending
-void GPU::GP0_TEXRAWTRI(GPUInstruction&) { } // draw textured triangle
-void GPU::GP0_TEXBLENDTRANSTRI(GPUInstruction&) { } // draw textured transparent triangle with blending
-void GPU::GP0_TEXRAWTRANSTRI(GPUInstruction&) { } // draw textured transparent triangle
-void GPU::GP0_TEXRAWQUAD(GPUInstruction&) { } // draw textured quadrilateral
-void GPU::GP0_TEXBLENDTRANSQUAD(GPUInstruction&) { } // draw textured transparent quad with blending
-void GPU::GP0_TEXRAWTRANSQUAD(GPUInstruction&) { } // draw textured transparent quadrilateral
-void GPU::GP0_SHADTRANSTRI(GPUInstruction&) { } // draw shaded transparent triangle
-void GPU::GP0_SHADTRANSQUAD(GPUInstruction&) { } // draw shaded transparent quadrilateral
-void GPU::GP0_SHADTEXBLENDTRI(GPUInstruction&) { } // draw shaded textured triangle with blending
-void GPU::GP0_SHADTEXRAWTRI(GPUInstruction&) { } // draw shaded textured triangle
-void GPU::GP0_SHADTEXBLENDQUAD(GPUInstruction&) { } // draw shaded textured quadrilateral with blending
-void GPU::GP0_SHADTEXRAWQUAD(GPUInstruction&) { } // draw shaded textured quadrilateral
-void GPU::GP0_MONOLINE(GPUInstruction&) { } // draw monochrome line
-void GPU::GP0_MONOTRANSLINE(GPUInstruction&) { } // draw monochrome transparent line
-void GPU::GP0_MONOPOLYLINE(GPUInstruction&) { } // draw monochrome multiline
-void GPU::GP0_MONOTRANSPOLYLINE(GPUInstruction&) { }
-void GPU::GP0_SHADLINE(GPUInstruction&) { }
-void GPU::GP0_SHADTRANSLINE(GPUInstruction&) { }
-void GPU::GP0_SHADPOLYLINE(GPUInstruction&) { }
-void GPU::GP0_SHADTRANSPOLYLINE(GPUInstruction&) { }
-void GPU::GP0_MONORECT(GPUInstruction&) { }
-void GPU::GP0_MONOTRANSRECT(GPUInstruction&) { }
-void GPU::GP0_MONORECT1X1(GPUInstruction&) { }
-void GPU::GP0_MONOTRANSRECT1X1(GPUInstruction&) { }
-void GPU::GP0_MONORECT8X8(GPUInstruction&) { }
-void GPU::GP0_MONOTRANSRECT8X8(GPUInstruction&) { }
-void GPU::GP0_MONORECT16X16(GPUInstruction&) { }
-void GPU::GP0_MONOTRANSRECT16X16(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDRECT(GPUInstruction&) { }
-void GPU::GP0_TEXRAWRECT(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDTRANSRECT(GPUInstruction&) { }
-void GPU::GP0_TEXRAWTRANSRECT(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDRECT1X1(GPUInstruction&) { }
-void GPU::GP0_TEXRAWRECT1X1(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDTRANSRECT1X1(GPUInstruction&) { }
-void GPU::GP0_TEXRAWTRANSRECT1X1(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDRECT8X8(GPUInstruction&) { }
-void GPU::GP0_TEXRAWRECT8X8(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDTRANSRECT8X8(GPUInstruction&) { }
-void GPU::GP0_TEXRAWTRANSRECT8X8(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDRECT16X16(GPUInstruction&) { }
-void GPU::GP0_TEXRAWRECT16X16(GPUInstruction&) { }
-void GPU::GP0_TEXBLENDTRANSRECT16X16(GPUInstruction&) { }
-void GPU::GP0_TEXRAWTRANSRECT16X16(GPUInstruction&) { }
+    draw_polygon();
+}
+void GPU::GP0_MONOTRI(GPUInstruction&) { draw_polygon(); } // draw monochrome triangle
+void GPU::GP0_MONOTRANSTRI(GPUInstruction&) { draw_polygon(); } // draw transparent monochrome triangle
+void GPU::GP0_MONOTRANSQUAD(GPUInstruction&) { draw_polygon(); } // draw transparent monochrome quadrilateral
+void GPU::GP0_TEXBLENDTRI(GPUInstruction&) { draw_polygon(); } // draw textured triangle with blending
+void GPU::GP0_TEXRAWTRI(GPUInstruction&) { draw_polygon(); } // draw textured triangle
+void GPU::GP0_TEXBLENDTRANSTRI(GPUInstruction&) { draw_polygon(); } // draw textured transparent triangle with blending
+void GPU::GP0_TEXRAWTRANSTRI(GPUInstruction&) { draw_polygon(); } // draw textured transparent triangle
+void GPU::GP0_TEXRAWQUAD(GPUInstruction&) { draw_polygon(); } // draw textured quadrilateral
+void GPU::GP0_TEXBLENDTRANSQUAD(GPUInstruction&) { draw_polygon(); } // draw textured transparent quad with blending
+void GPU::GP0_TEXRAWTRANSQUAD(GPUInstruction&) { draw_polygon(); } // draw textured transparent quadrilateral
+void GPU::GP0_SHADTRANSTRI(GPUInstruction&) { draw_polygon(); } // draw shaded transparent triangle
+void GPU::GP0_SHADTRANSQUAD(GPUInstruction&) { draw_polygon(); } // draw shaded transparent quadrilateral
+void GPU::GP0_SHADTEXBLENDTRI(GPUInstruction&) { draw_polygon(); } // draw shaded textured triangle with blending
+void GPU::GP0_SHADTEXRAWTRI(GPUInstruction&) { draw_polygon(); } // draw shaded textured triangle
+void GPU::GP0_SHADTEXBLENDQUAD(GPUInstruction&) { draw_polygon(); } // draw shaded textured quadrilateral with blending
+void GPU::GP0_SHADTEXRAWQUAD(GPUInstruction&) { draw_polygon(); } // draw shaded textured quadrilateral
+void GPU::GP0_MONOLINE(GPUInstruction&) { draw_line(); } // draw monochrome line
+void GPU::GP0_MONOTRANSLINE(GPUInstruction&) { draw_line(); } // draw monochrome transparent line
+void GPU::GP0_MONOPOLYLINE(GPUInstruction&) { draw_line(); } // draw monochrome multiline
+void GPU::GP0_MONOTRANSPOLYLINE(GPUInstruction&) { draw_line(); }
+void GPU::GP0_SHADLINE(GPUInstruction&) { draw_line(); }
+void GPU::GP0_SHADTRANSLINE(GPUInstruction&) { draw_line(); }
+void GPU::GP0_SHADPOLYLINE(GPUInstruction&) { draw_line(); }
+void GPU::GP0_SHADTRANSPOLYLINE(GPUInstruction&) { draw_line(); }
+void GPU::GP0_MONORECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONOTRANSRECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONORECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONOTRANSRECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONORECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONOTRANSRECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONORECT16X16(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_MONOTRANSRECT16X16(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDRECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWRECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDTRANSRECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWTRANSRECT(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDRECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWRECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDTRANSRECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWTRANSRECT1X1(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDRECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWRECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDTRANSRECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWTRANSRECT8X8(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDRECT16X16(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWRECT16X16(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXBLENDTRANSRECT16X16(GPUInstruction&) { draw_rectangle(); }
+void GPU::GP0_TEXRAWTRANSRECT16X16(GPUInstruction&) { draw_rectangle(); }
 void GPU::GP0_DRAWMODE(GPUInstruction& ins)
 {
     m_tex_page_base_x   = (ins >> 0) & 0b1111;
@@ -321,15 +1240,25 @@ void GPU::GP0_DRAWOFF(GPUInstruction& ins)
     
     m_drawing_x_offset = (static_cast<s16>(x << 5)) >> 5;
     m_drawing_y_offset = (static_cast<s16>(y << 5)) >> 5;
-    
-    m_renderer.draw();
 }
 void GPU::GP0_LDIMAGE(GPUInstruction&)
 {
-    u32 resolution = m_gp0_arguments[2];
+    u32 destination = m_gp0_arguments[1];
+    u32 resolution  = m_gp0_arguments[2];
+    
+    //sizes of 0 select the whole of VRAM
+    u16 width  = ((((resolution >>  0) & 0xFFFF) - 1) & (VRAMWidth  - 1)) + 1;
+    u16 height = ((((resolution >> 16) & 0xFFFF) - 1) & (VRAMHeight - 1)) + 1;
     
-    u16 width  = (resolution >>  0) & 0xFFFF;
-    u16 height = (resolution >> 16) & 0xFFFF;
+    //queued primitives land underneath the image
+    m_software_renderer.flush();
+    
+    m_image_load.x      = (destination >>  0) & (VRAMWidth  - 1);
+    m_image_load.y      = (destination >> 16) & (VRAMHeight - 1);
+    m_image_load.width  = width;
+    m_image_load.height = height;
+    m_image_load.row    = 0;
+    m_image_load.fill   = 0;
     
     u32 image_size = (width * height + 1) & ~u32(1);
     
@@ -339,7 +1268,41 @@ void GPU::GP0_LDIMAGE(GPUInstruction&)
 }
 void GPU::GP0_STIMAGE(GPUInstruction&)
 {
-    std::printf("GPU Warning: Store Image unimplemented\n");
+    u32 source     = m_gp0_arguments[1];
+    u32 resolution = m_gp0_arguments[2];
+    
+    u16 x      = (source >>  0) & (VRAMWidth  - 1);
+    u16 y      = (source >> 16) & (VRAMHeight - 1);
+    u16 width  = ((((resolution >>  0) & 0xFFFF) - 1) & (VRAMWidth  - 1)) + 1;
+    u16 height = ((((resolution >> 16) & 0xFFFF) - 1) & (VRAMHeight - 1)) + 1;
+    
+    //pull back only the requested region of whatever the renderer drew
+    if(m_renderer_type == Config::RendererType::OpenGL)
+    {
+        m_renderer->download_vram(x, y, width, height, &m_vram[0][0]);
+    }
+    else
+    {
+        m_software_renderer.flush();
+    }
+    
+    m_read_fifo.assign((width * height + 1) / 2, 0);
+    m_read_index = 0;
+    
+    u16* pixels = reinterpret_cast<u16*>(m_read_fifo.data());
+    
+    u16 first_width  = std::min<u32>(width, VRAMWidth - x);
+    u16 second_width = width - first_width;
+    
+    for(u16 row = 0; row < height; row++)
+    {
+        u16 source_y = (y + row) & (VRAMHeight - 1);
+        
+        std::memcpy(pixels, &m_vram[source_y][x], first_width * sizeof(u16));
+        std::memcpy(pixels + first_width, &m_vram[source_y][0], second_width * sizeof(u16));
+        
+        pixels += width;
+    }
 }
 
 //GP1 instructions
@@ -349,18 +1312,35 @@ void GPU::GP1_UNK(GPUInstruction& ins)
 }
 void GPU::GP1_CLRFIFO(GPUInstruction&)
 {
-    //TODO: clear fifo
+    //an image load cut short keeps the pixels which already arrived
+    if(m_gp0_mode == GP0Mode::Image && m_image_load.fill != 0)
+    {
+        u16 y = (m_image_load.y + m_image_load.row) & (VRAMHeight - 1);
+        
+        vram_write_row(m_image_load.x, y, m_image_load.pixels, m_image_load.fill);
+    }
     
+    m_image_load.row    = 0;
+    m_image_load.height = 0;
+    m_image_load.fill   = 0;
+    
+    m_read_fifo.clear();
+    m_read_index = 0;
+
     m_gp0_arguments.clear();
-    m_gp0_remaining_data = 0;
+    m_gp0_remaining_data  = 0;
+    m_gp0_packet          = nullptr;
+    m_gp0_polyline_opened = false;
     m_gp0_mode = GP0Mode::Command;
 }
 void GPU::GP1_ACKINT(GPUInstruction&)
 {
     m_interrupt = false;
 }
-void GPU::GP1_RST(GPUInstruction&)
+void GPU::GP1_RST(GPUInstruction& ins)
 {
+    GP1_CLRFIFO(ins);
+    
     m_interrupt = 0;
     m_tex_page_base_x = 0;
     m_tex_page_base_y = 0;
@@ -396,8 +1376,13 @@ void GPU::GP1_RST(GPUInstruction&)
     m_display_v_start = 0x10;
     m_display_v_end = 0x100;
     m_display_depth = DisplayDepth::Depth15Bits;
+    m_field = Field::Top;
     
-    //TODO: shit
+    //decoded pages stay valid, but the cache starts out empty like the hardware's
+    if(m_renderer)
+    {
+        m_renderer->clear_texture_cache();
+    }
 }
 void GPU::GP1_DISPLAYDISABLE(GPUInstruction& ins)
 {
@@ -416,7 +1401,7 @@ void GPU::GP1_HRANGE(GPUInstruction& ins)
 void GPU::GP1_VRANGE(GPUInstruction& ins)
 {
     m_display_v_start = (ins >>  0) & 0x3FF;
-    m_display_v_end   = (ins >> 12) & 0x3FF;
+    m_display_v_end   = (ins >> 10) & 0x3FF;
 }
 void GPU::GP1_DMAMODE(GPUInstruction& ins)
 {
@@ -429,8 +1414,7 @@ void GPU::GP1_DISPLAYMODE(GPUInstruction& ins)
 
     m_video_mode = static_cast<VideoMode>(!!(ins & 0x8));
     
-    //TODO: this bit flip is weird
-    m_display_depth = static_cast<DisplayDepth>(!(ins & 0x10));
+    m_display_depth = static_cast<DisplayDepth>((ins >> 4) & 1);
     
     m_v_interlace = ins & 0x20;
     
@@ -4,9 +4,22 @@
 #include "Registers.hpp"
 #include "GPUInstruction.hpp"
 #include "Renderer.hpp"
+#include "SoftwareRenderer.hpp"
+#include "Config.hpp"
+#include "DirtyTracker.hpp"
+#include "CommandRing.hpp"
+#include "GPUCapture.hpp"
+#include "FrameDump.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <utility>
+#include <vector>
 
 class CPU;
 
@@ -47,7 +60,7 @@ public:
     {
         return (hr2 & 1) | ((hr1 & 3) << 1);
     }
-    u32 hres_info_status(HResolution hres)
+    u32 hres_info_status(HResolution hres) const
     {
         return static_cast<u32>(hres) << 16;
     }
@@ -72,16 +85,60 @@ public:
         VRAMToCPU = 3
     };
 
+    static constexpr const u32 VRAMWidth  = 1024;
+    static constexpr const u32 VRAMHeight = 512;
+    
+    using VRAMDirtyTracker = DirtyTracker<VRAMWidth * VRAMHeight * sizeof(u16), 0x1000>;
+    
     GPU(CPU* cpu) : m_cpu(cpu)
     {
         m_display_disabled = true;
+        std::memset(m_vram, 0, sizeof(m_vram));
     }
     
+   ~GPU() { stop_thread(); }
+    
+    void configure(const Config&);
+    
     void set(u8 i, u32 value);
     u32  get(u8 i);
     void gp0_exec(GPUInstruction);
+    void gp0_exec_burst(const u32* words, size_t count);
     void gp1_exec(GPUInstruction);
     
+    /**
+     * GP0 words written in bulk by DMA, queued for the gpu thread when there is one
+     */
+    void gp0_write_burst(const u32* words, size_t count);
+    
+    /**
+     * wait until the gpu thread has run everything queued so far
+     */
+    void sync();
+    
+    /**
+     * cycles from one vertical blank to the next in the current video mode
+     */
+    u32 frame_cycles() const;
+    
+    /**
+     * end of an emulated frame, the display area is presented
+     */
+    void vblank();
+    
+    u32 collect_dirty_vram(std::vector<u32>& pages)
+    {
+        sync();
+        m_software_renderer.flush();
+        return m_vram_dirty.collect(pages);
+    }
+    
+    /**
+     * drain up to count words of a GP0_STIMAGE transfer, used by DMA in bulk
+     */
+    void gpuread_burst(u32* words, u32 count);
+    bool gpuread_pending() const { return m_read_index < m_read_fifo.size(); }
+    
 protected:
     
     friend class CPU;
@@ -203,7 +260,7 @@ protected:
     
     //GP1 instructions
     void GP1_UNK(GPUInstruction&); // unknown instruction
-    void GP1_CLRFIFO(GPUInstruction&); // clears fifo and resets the gpu
+    void GP1_CLRFIFO(GPUInstruction&); // drops the partial GP0 packet, image load and readback
     void GP1_ACKINT(GPUInstruction&); // acknowledge interrupt
     void GP1_RST(GPUInstruction&); // reset GPU flags
     void GP1_DISPLAYDISABLE(GPUInstruction&); // set display disable flag
@@ -215,88 +272,99 @@ protected:
     
     typedef void (GPU::*OpHandler)(GPUInstruction&);
     
-    std::pair<OpHandler, u32> m_gp0_op_handlers[256] =
+    /**
+     * words in a GP0 packet, command included, polylines go on past that a vertex
+     * at a time until the terminator
+     */
+    struct GP0Packet
+    {
+        OpHandler handler;
+        u8        length;
+        bool      polyline;
+    };
+    
+    static constexpr const GP0Packet GP0Packets[256] =
     {
-        [0 ... 0xFF] = { &GPU::GP0_UNK, 1 },
-        [0x00] = { &GPU::GP0_NOP, 1 },
-        [0x01] = { &GPU::GP0_CLRCACHE, 1 },
+        [0 ... 0xFF] = { &GPU::GP0_UNK, 1, false },
+        [0x00] = { &GPU::GP0_NOP, 1, false },
+        [0x01] = { &GPU::GP0_CLRCACHE, 1, false },
 		
-		[0x20] = { &GPU::GP0_MONOTRI, 4 },
-		[0x22] = { &GPU::GP0_MONOTRANSTRI, 4 },
-        [0x28] = { &GPU::GP0_MONOQUAD, 5 },
-		[0x2A] = { &GPU::GP0_MONOTRANSQUAD, 5 }, 
+		[0x20] = { &GPU::GP0_MONOTRI, 4, false },
+		[0x22] = { &GPU::GP0_MONOTRANSTRI, 4, false },
+        [0x28] = { &GPU::GP0_MONOQUAD, 5, false },
+		[0x2A] = { &GPU::GP0_MONOTRANSQUAD, 5, false }, 
 		
-		[0x24] = { &GPU::GP0_TEXBLENDTRI, 7 },
-		[0x25] = { &GPU::GP0_TEXRAWTRI, 7 },
-		[0x26] = { &GPU::GP0_TEXBLENDTRANSTRI, 7 },
-		[0x27] = { &GPU::GP0_TEXRAWTRANSTRI, 7 },
-        [0x2C] = { &GPU::GP0_TEXBLENDQUAD, 9 },
-		[0x2D] = { &GPU::GP0_TEXRAWQUAD, 9 },
-		[0x2E] = { &GPU::GP0_TEXBLENDTRANSQUAD, 9 },
-		[0x2F] = { &GPU::GP0_TEXRAWTRANSQUAD, 9 },
+		[0x24] = { &GPU::GP0_TEXBLENDTRI, 7, false },
+		[0x25] = { &GPU::GP0_TEXRAWTRI, 7, false },
+		[0x26] = { &GPU::GP0_TEXBLENDTRANSTRI, 7, false },
+		[0x27] = { &GPU::GP0_TEXRAWTRANSTRI, 7, false },
+        [0x2C] = { &GPU::GP0_TEXBLENDQUAD, 9, false },
+		[0x2D] = { &GPU::GP0_TEXRAWQUAD, 9, false },
+		[0x2E] = { &GPU::GP0_TEXBLENDTRANSQUAD, 9, false },
+		[0x2F] = { &GPU::GP0_TEXRAWTRANSQUAD, 9, false },
 		
-        [0x30] = { &GPU::GP0_SHADTRI, 6 },
-		[0x32] = { &GPU::GP0_SHADTRANSTRI, 6 },
-        [0x38] = { &GPU::GP0_SHADQUAD, 8 },
-		[0x3A] = { &GPU::GP0_SHADTRANSQUAD, 8 },
+        [0x30] = { &GPU::GP0_SHADTRI, 6, false },
+		[0x32] = { &GPU::GP0_SHADTRANSTRI, 6, false },
+        [0x38] = { &GPU::GP0_SHADQUAD, 8, false },
+		[0x3A] = { &GPU::GP0_SHADTRANSQUAD, 8, false },
 		
-		[0x34] = { &GPU::GP0_SHADTEXBLENDTRI, 9 },
-		[0x36] = { &GPU::GP0_SHADTEXRAWTRI, 9 },
-		[0x3C] = { &GPU::GP0_SHADTEXBLENDQUAD, 12 },
-		[0x3E] = { &GPU::GP0_SHADTEXRAWQUAD, 12 },
+		[0x34] = { &GPU::GP0_SHADTEXBLENDTRI, 9, false },
+		[0x36] = { &GPU::GP0_SHADTEXRAWTRI, 9, false },
+		[0x3C] = { &GPU::GP0_SHADTEXBLENDQUAD, 12, false },
+		[0x3E] = { &GPU::GP0_SHADTEXRAWQUAD, 12, false },
 		
 		/**
 		 * TODO: undocumented commands 35, 37, 3D, 3F, 21, 23, 29, 2B, 31, 33, 39, 3B
 		 */
 		
-		[0x40] = { &GPU::GP0_MONOLINE, 3 },
-		[0x42] = { &GPU::GP0_MONOTRANSLINE, 3 },
-		[0x48] = { &GPU::GP0_MONOPOLYLINE, 3 },
-		[0x4A] = { &GPU::GP0_MONOTRANSPOLYLINE, 3 },
+		[0x40] = { &GPU::GP0_MONOLINE, 3, false },
+		[0x42] = { &GPU::GP0_MONOTRANSLINE, 3, false },
+		[0x48] = { &GPU::GP0_MONOPOLYLINE, 3, true },
+		[0x4A] = { &GPU::GP0_MONOTRANSPOLYLINE, 3, true },
 		
-		[0x50] = { &GPU::GP0_SHADLINE, 4 },
-		[0x52] = { &GPU::GP0_SHADTRANSLINE, 4 },
-		[0x58] = { &GPU::GP0_SHADPOLYLINE, 4 },
-		[0x5A] = { &GPU::GP0_SHADTRANSPOLYLINE, 4 },
+		[0x50] = { &GPU::GP0_SHADLINE, 4, false },
+		[0x52] = { &GPU::GP0_SHADTRANSLINE, 4, false },
+		[0x58] = { &GPU::GP0_SHADPOLYLINE, 4, true },
+		[0x5A] = { &GPU::GP0_SHADTRANSPOLYLINE, 4, true },
 		
-		[0x60] = { &GPU::GP0_MONORECT, 3 },
-		[0x62] = { &GPU::GP0_MONOTRANSRECT, 3 },
-		[0x68] = { &GPU::GP0_MONORECT1X1, 2 },
-		[0x6A] = { &GPU::GP0_MONOTRANSRECT1X1, 2 },
-		[0x70] = { &GPU::GP0_MONORECT8X8, 2 },
-		[0x72] = { &GPU::GP0_MONOTRANSRECT8X8, 2 },
-		[0x78] = { &GPU::GP0_MONORECT16X16, 2 },
-		[0x7A] = { &GPU::GP0_MONOTRANSRECT16X16, 2 },
+		[0x60] = { &GPU::GP0_MONORECT, 3, false },
+		[0x62] = { &GPU::GP0_MONOTRANSRECT, 3, false },
+		[0x68] = { &GPU::GP0_MONORECT1X1, 2, false },
+		[0x6A] = { &GPU::GP0_MONOTRANSRECT1X1, 2, false },
+		[0x70] = { &GPU::GP0_MONORECT8X8, 2, false },
+		[0x72] = { &GPU::GP0_MONOTRANSRECT8X8, 2, false },
+		[0x78] = { &GPU::GP0_MONORECT16X16, 2, false },
+		[0x7A] = { &GPU::GP0_MONOTRANSRECT16X16, 2, false },
 		
-		[0x64] = { &GPU::GP0_TEXBLENDRECT, 4 },
-		[0x65] = { &GPU::GP0_TEXRAWRECT, 4 },
-		[0x66] = { &GPU::GP0_TEXBLENDTRANSRECT, 4 },
-		[0x67] = { &GPU::GP0_TEXRAWTRANSRECT, 4 },
+		[0x64] = { &GPU::GP0_TEXBLENDRECT, 4, false },
+		[0x65] = { &GPU::GP0_TEXRAWRECT, 4, false },
+		[0x66] = { &GPU::GP0_TEXBLENDTRANSRECT, 4, false },
+		[0x67] = { &GPU::GP0_TEXRAWTRANSRECT, 4, false },
 		
-		[0x6C] = { &GPU::GP0_TEXBLENDRECT1X1, 3 },
-		[0x6D] = { &GPU::GP0_TEXRAWRECT1X1, 3 },
-		[0x6E] = { &GPU::GP0_TEXBLENDTRANSRECT1X1, 3 },
-		[0x6F] = { &GPU::GP0_TEXRAWTRANSRECT1X1, 3 },
-		[0x74] = { &GPU::GP0_TEXBLENDRECT8X8, 3 },
-		[0x75] = { &GPU::GP0_TEXRAWRECT8X8, 3 },
-		[0x76] = { &GPU::GP0_TEXBLENDTRANSRECT8X8, 3 },
-		[0x77] = { &GPU::GP0_TEXRAWTRANSRECT8X8, 3 },
-		[0x7C] = { &GPU::GP0_TEXBLENDRECT16X16, 3 },
-		[0x7D] = { &GPU::GP0_TEXRAWRECT16X16, 3 },
-		[0x7E] = { &GPU::GP0_TEXBLENDTRANSRECT16X16, 3 },
-		[0x7F] = { &GPU::GP0_TEXRAWTRANSRECT16X16, 3 },
+		[0x6C] = { &GPU::GP0_TEXBLENDRECT1X1, 3, false },
+		[0x6D] = { &GPU::GP0_TEXRAWRECT1X1, 3, false },
+		[0x6E] = { &GPU::GP0_TEXBLENDTRANSRECT1X1, 3, false },
+		[0x6F] = { &GPU::GP0_TEXRAWTRANSRECT1X1, 3, false },
+		[0x74] = { &GPU::GP0_TEXBLENDRECT8X8, 3, false },
+		[0x75] = { &GPU::GP0_TEXRAWRECT8X8, 3, false },
+		[0x76] = { &GPU::GP0_TEXBLENDTRANSRECT8X8, 3, false },
+		[0x77] = { &GPU::GP0_TEXRAWTRANSRECT8X8, 3, false },
+		[0x7C] = { &GPU::GP0_TEXBLENDRECT16X16, 3, false },
+		[0x7D] = { &GPU::GP0_TEXRAWRECT16X16, 3, false },
+		[0x7E] = { &GPU::GP0_TEXBLENDTRANSRECT16X16, 3, false },
+		[0x7F] = { &GPU::GP0_TEXRAWTRANSRECT16X16, 3, false },
 		
-        [0xE1] = { &GPU::GP0_DRAWMODE, 1 },
-        [0xE2] = { &GPU::GP0_TEXWIN, 1 },
-        [0xE3] = { &GPU::GP0_DRAWATL, 1 },
-        [0xE4] = { &GPU::GP0_DRAWABR, 1 },
-        [0xE5] = { &GPU::GP0_DRAWOFF, 1 },
-        [0xE6] = { &GPU::GP0_MASKBIT, 1 },
-        [0xA0] = { &GPU::GP0_LDIMAGE, 3 },
-        [0xC0] = { &GPU::GP0_STIMAGE, 3 },
+        [0xE1] = { &GPU::GP0_DRAWMODE, 1, false },
+        [0xE2] = { &GPU::GP0_TEXWIN, 1, false },
+        [0xE3] = { &GPU::GP0_DRAWATL, 1, false },
+        [0xE4] = { &GPU::GP0_DRAWABR, 1, false },
+        [0xE5] = { &GPU::GP0_DRAWOFF, 1, false },
+        [0xE6] = { &GPU::GP0_MASKBIT, 1, false },
+        [0xA0] = { &GPU::GP0_LDIMAGE, 3, false },
+        [0xC0] = { &GPU::GP0_STIMAGE, 3, false },
     };
     
-    OpHandler m_gp1_op_handlers[256] =
+    static constexpr const OpHandler GP1Handlers[256] =
     {
         [0x00 ... 0xFF] = &GPU::GP1_UNK,
         [0x00] = &GPU::GP1_RST,
@@ -323,6 +391,12 @@ protected:
         
         void clear()         { m_length = 0; }
         void push(u32 value) { assert(m_length < 12); m_buffer[m_length++] = value; }
+        void assign(const u32* values, u32 length)
+        {
+            assert(length <= 12);
+            std::memcpy(m_buffer, values, length * sizeof(u32));
+            m_length = length;
+        }
         
         u32 length() const { return m_length; }
         
@@ -333,8 +407,110 @@ protected:
         
     } m_gp0_arguments;
     u32 m_gp0_remaining_data { 0 };
-    OpHandler m_gp0_queued_handler { nullptr };
     
-    //OpenGL renderer
-    Renderer m_renderer { 1024, 512 };
+    //packet being gathered, nullptr between packets
+    const GP0Packet* m_gp0_packet          { nullptr };
+    bool             m_gp0_polyline_opened { false };
+    
+    void gp0_dispatch(GPUInstruction last);
+    
+    //VRAM, 1024x512 pixels of 16 bits
+    u16 m_vram[VRAMHeight][VRAMWidth];
+    VRAMDirtyTracker m_vram_dirty;
+    
+    //GP0_LDIMAGE transfer state, pixels are gathered into whole rows before they hit VRAM
+    struct
+    {
+        u16 x;
+        u16 y;
+        u16 width;
+        u16 height;
+        u16 row;
+        u16 fill;
+        u16 pixels[VRAMWidth];
+    } m_image_load;
+    
+    //GP0_STIMAGE readback, the whole rectangle is packed up front and streamed out through GPUREAD
+    std::vector<u32> m_read_fifo;
+    u32              m_read_index { 0 };
+    u32              m_gpuread    { 0 };
+    
+    void image_load(const u16* pixels, u32 count);
+    void vram_write_row(u16 x, u16 y, const u16* pixels, u16 width);
+    
+    //polygon, line and rectangle commands each share one decoder
+    void draw_polygon();
+    void draw_line();
+    void draw_rectangle();
+    SoftwareRenderer::State software_state(u16 clut) const;
+    Renderer::DrawState     draw_state(const SoftwareRenderer::State& software, bool semi, bool dither) const;
+    u8                      blend_flags(const SoftwareRenderer::State& software, bool semi) const;
+    
+    /**
+     * rows the software renderer may have drawn to, for the dirty tracker and the window
+     */
+    void software_drawn(s32 top, s32 bottom, const SoftwareRenderer::State& state);
+    
+    /**
+     * hand the rows drawn since the last present to the window as merged spans
+     */
+    void upload_software_rows();
+    
+    //rows drawn by the software renderer and not yet uploaded to the window
+    bool m_software_rows[VRAMHeight] {};
+    
+    //command stream recording, cycles come from the cpu's scheduler
+    GPUCapture m_capture;
+    
+    u64 cycles() const;
+    
+    //hashes and encodes the displayed area on every vblank
+    FrameDump m_frame_dump;
+    
+    void dump_frame(u16 width, u16 height);
+    
+    //OpenGL renderer, also presents the software renderer's output, created by configure()
+    //only when something is drawn with it or shown on a window
+    std::unique_ptr<Renderer> m_renderer;
+    
+    void present();
+    
+    //software renderer drawing into m_vram
+    SoftwareRenderer     m_software_renderer { &m_vram[0][0] };
+    Config::RendererType m_renderer_type { Config::RendererType::OpenGL };
+    
+    //optional gpu thread, the cpu thread only queues port writes for it
+    enum class Command : u8
+    {
+        GP0,
+        GP1,
+        VBlank
+    };
+    
+    struct PortWrite
+    {
+        u32     word;
+        Command command;
+    };
+    
+    static constexpr const u32 CommandRingSize = 64 * 1024;
+    static constexpr const u32 IdleSpins       = 256;
+    
+    void start_thread();
+    void stop_thread();
+    void thread_main();
+    void submit(Command command, u32 word);
+    u32  gpustat() const;
+    
+    CommandRing<PortWrite, CommandRingSize> m_commands;
+    std::thread                             m_thread;
+    bool                                    m_threaded    { false };
+    bool                                    m_gp1_pending { false };
+    u64                                     m_submitted   { 0 };
+    std::atomic<u64>                        m_retired     { 0 };
+    std::atomic<u32>                        m_stat        { 0 };
+    std::atomic<bool>                       m_idle        { false };
+    std::atomic<bool>                       m_quit        { false };
+    std::mutex                              m_wake_mutex;
+    std::condition_variable                 m_wake;
 };
@@ -0,0 +1,216 @@
+#include "GPUCapture.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+bool GPUCapture::open(const char* path)
+{
+    close();
+
+    m_file.open(path, File::OpenMode::Write);
+
+    if(!m_file.is_file())
+    {
+        std::printf("GPUCapture::open() warning: can't write %s\n", path);
+        return false;
+    }
+
+    m_buffer.reserve(BufferSize + 64);
+    m_buffer.assign(Magic, Magic + sizeof(Magic));
+    put_word(Version);
+
+    m_last_cycle = 0;
+    m_recording  = true;
+
+    return true;
+}
+
+void GPUCapture::close()
+{
+    if(!m_recording)
+    {
+        return;
+    }
+
+    flush();
+    m_file.close();
+
+    m_recording = false;
+}
+
+void GPUCapture::write(Record record, u64 cycle, const u32* words, u32 count)
+{
+    m_buffer.push_back(static_cast<u8>(record));
+    put_varint(cycle - m_last_cycle);
+
+    m_last_cycle = cycle;
+
+    if(record == Record::GP0Burst || record == Record::GPURead)
+    {
+        put_varint(count);
+    }
+
+    for(u32 i = 0; i < count; i++)
+    {
+        put_word(words[i]);
+    }
+
+    //the emulator never shuts down cleanly, so every frame goes out as soon as it ends
+    if(record == Record::VBlank || m_buffer.size() >= BufferSize)
+    {
+        flush();
+    }
+}
+
+void GPUCapture::put_varint(u64 value)
+{
+    //7 bits at a time, low bits first, the top bit says more follow
+    while(value >= 0x80)
+    {
+        m_buffer.push_back(static_cast<u8>(value) | 0x80);
+        value >>= 7;
+    }
+
+    m_buffer.push_back(static_cast<u8>(value));
+}
+
+void GPUCapture::put_word(u32 word)
+{
+    //little endian regardless of the host
+    for(u32 i = 0; i < 4; i++)
+    {
+        m_buffer.push_back(static_cast<u8>(word >> (i * 8)));
+    }
+}
+
+void GPUCapture::flush()
+{
+    m_file.write(m_buffer);
+    m_file.flush();
+    m_buffer.clear();
+}
+
+bool GPUCaptureReader::open(const char* path)
+{
+    File file(path);
+
+    if(!file.is_file())
+    {
+        std::printf("GPUCaptureReader::open() error: can't read %s\n", path);
+        return false;
+    }
+
+    m_data   = file.read();
+    m_offset = sizeof(GPUCapture::Magic);
+    m_cycle  = 0;
+
+    u32 version = 0;
+
+    if(m_data.size() < sizeof(GPUCapture::Magic) || std::memcmp(m_data.data(), GPUCapture::Magic, sizeof(GPUCapture::Magic)) != 0 || !get_word(version))
+    {
+        std::printf("GPUCaptureReader::open() error: %s is not a GPU capture\n", path);
+        return false;
+    }
+
+    if(version == 0 || version > GPUCapture::Version)
+    {
+        std::printf("GPUCaptureReader::open() error: %s is version %u, expected %u or older\n", path, version, GPUCapture::Version);
+        return false;
+    }
+
+    return true;
+}
+
+bool GPUCaptureReader::next(GPUCapture::Record& record, u64& cycle, const std::vector<u32>*& words)
+{
+    if(m_offset >= m_data.size())
+    {
+        return false;
+    }
+
+    record = static_cast<GPUCapture::Record>(m_data[m_offset++]);
+
+    u64 delta = 0;
+
+    if(!get_varint(delta))
+    {
+        return false;
+    }
+
+    m_cycle += delta;
+    cycle    = m_cycle;
+
+    u64 count = 0;
+
+    switch(record)
+    {
+        case GPUCapture::Record::GP0:
+        case GPUCapture::Record::GP1:      { count = 1; break; }
+        case GPUCapture::Record::GP0Burst:
+        case GPUCapture::Record::GPURead:  { if(!get_varint(count)) { return false; } break; }
+        case GPUCapture::Record::VBlank:   { count = 0; break; }
+
+        default:
+        {
+            std::printf("GPUCaptureReader::next() error: unknown record %u\n", static_cast<u32>(record));
+            return false;
+        }
+    }
+
+    if(count > (m_data.size() - m_offset) / 4)
+    {
+        return false;
+    }
+
+    m_words.resize(count);
+
+    for(u32& word : m_words)
+    {
+        get_word(word);
+    }
+
+    words = &m_words;
+
+    return true;
+}
+
+bool GPUCaptureReader::get_varint(u64& value)
+{
+    value = 0;
+
+    for(u32 shift = 0; shift < 64; shift += 7)
+    {
+        if(m_offset >= m_data.size())
+        {
+            return false;
+        }
+
+        u8 byte = m_data[m_offset++];
+
+        value |= u64(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool GPUCaptureReader::get_word(u32& word)
+{
+    if(m_data.size() - m_offset < 4)
+    {
+        return false;
+    }
+
+    word = 0;
+
+    for(u32 i = 0; i < 4; i++)
+    {
+        word |= u32(m_data[m_offset++]) << (i * 8);
+    }
+
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "File.hpp"
+#include "Types.hpp"
+
+#include <vector>
+
+/**
+ * binary recording of everything written to the GPU
+ *
+ * the file starts with the magic and a version, followed by records of a type
+ * byte, the cycles since the previous record as a LEB128 varint and a payload:
+ * GP0 and GP1 writes carry their word, DMA bursts a varint word count and the
+ * words, vertical blanks nothing. GPUREAD reads, by the cpu or by DMA, carry a
+ * varint count and the words read so a replay can drain and compare them
+ *
+ * version 1 files have no GPUREAD records and are still read
+ */
+class GPUCapture
+{
+public:
+
+    enum class Record : u8
+    {
+        GP0,
+        GP1,
+        GP0Burst,
+        VBlank,
+        GPURead
+    };
+
+    static constexpr const char Magic[8] = { 'D', 'S', 'G', 'P', 'U', 'C', 'A', 'P' };
+    static constexpr const u32  Version  = 2;
+
+    GPUCapture() {}
+   ~GPUCapture() { close(); }
+
+    bool open(const char* path);
+    void close();
+
+    bool recording() const { return m_recording; }
+
+    void write(Record record, u64 cycle, const u32* words, u32 count);
+
+private:
+
+    static constexpr const u32 BufferSize = 1024 * 1024;
+
+    void put_varint(u64 value);
+    void put_word(u32 word);
+    void flush();
+
+    File            m_file;
+    std::vector<u8> m_buffer;
+    u64             m_last_cycle { 0 };
+    bool            m_recording  { false };
+};
+
+/**
+ * reads a capture back record by record
+ */
+class GPUCaptureReader
+{
+public:
+
+    bool open(const char* path);
+
+    /**
+     * next record, false at the end of the capture or when it is cut short
+     */
+    bool next(GPUCapture::Record& record, u64& cycle, const std::vector<u32>*& words);
+
+private:
+
+    bool get_varint(u64& value);
+    bool get_word(u32& word);
+
+    std::vector<u8>  m_data;
+    size_t           m_offset { 0 };
+    u64              m_cycle  { 0 };
+    std::vector<u32> m_words;
+};
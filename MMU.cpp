@@ -63,6 +63,11 @@ if constexpr(t == MemAccessType::Read) { return regs.get(static_cast<u8>(reg));
         {
             u32 physical_address = virtual_address & 0x001FFFFF;
             
+            if constexpr (t == MemAccessType::Write)
+            {
+                m_ram_dirty.mark(physical_address);
+            }
+            
             RW(*((Width*)(m_physical_ram + physical_address)));
             break;
         }
@@ -92,6 +97,11 @@ if constexpr(t == MemAccessType::Read) { return regs.get(static_cast<u8>(reg));
         {
             u32 physical_address = virtual_address & 0x000003FF;
             
+            if constexpr (t == MemAccessType::Write)
+            {
+                m_scrpad_dirty.mark(physical_address);
+            }
+            
             RW(*((Width*)(m_scrpad + physical_address)));
             break;
         }
@@ -168,7 +178,10 @@ if constexpr(t == MemAccessType::Read) { return regs.get(static_cast<u8>(reg));
                     break;
                 }
                     
-                case 0x70 ... 0x78: //IRQ
+                case 0x70: /* IRQ status */ { RWREG(m_cpu->m_irq, IRQReg::STAT); break; }
+                case 0x74: /* IRQ mask */ { RWREG(m_cpu->m_irq, IRQReg::MASK); break; }
+                case 0x71 ... 0x73:
+                case 0x75 ... 0x78: //IRQ
                 {
                     break;
                 }
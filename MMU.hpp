@@ -2,6 +2,7 @@
 
 #include "Types.hpp"
 #include "Registers.hpp"
+#include "DirtyTracker.hpp"
 
 class CPU;
 
@@ -30,11 +31,23 @@ public:
     void copy_to_vm(u32 dest, void* src, u32 size);
     void copy_to_host(void* dest, u32 src, u32 size);
     
+    /**
+     * dirty page tracking for incremental snapshots
+     */
+    static constexpr const u32 DirtyPageSize = 0x1000;
     
+    using RAMDirtyTracker        = DirtyTracker<0x200000, DirtyPageSize>;
+    using ScratchpadDirtyTracker = DirtyTracker<0x400, DirtyPageSize>;
+    
+    void mark_ram_dirty(u32 physical_address, u32 size) { m_ram_dirty.mark(physical_address & 0x1FFFFF, size); }
+    
+    u32 collect_dirty_ram(std::vector<u32>& pages)        { return m_ram_dirty.collect(pages); }
+    u32 collect_dirty_scratchpad(std::vector<u32>& pages) { return m_scrpad_dirty.collect(pages); }
     
 protected:
     
     friend class CPU;
+    friend class DMA;
     
     template<typename Width, MemAccessType t>
     Width mem_access(u32 virtual_address, Width value);
@@ -48,6 +61,9 @@ protected:
     u8 m_bios[0x80000];
     u8 m_ioports[0x200];
     
+    RAMDirtyTracker        m_ram_dirty;
+    ScratchpadDirtyTracker m_scrpad_dirty;
+    
     union
     {
         struct
@@ -69,3 +69,9 @@ enum class GPUReg : u8
     GP0_READ, //write GP0 - read READ
     GP1_STAT, //write GP1 - read STAT
 };
+
+enum class IRQReg : u8
+{
+    STAT, //I_STAT - write 0 to acknowledge
+    MASK, //I_MASK
+};
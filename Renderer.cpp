@@ -1,25 +1,47 @@
 #include "Renderer.hpp"
 
-void Renderer::init()
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+
+namespace
 {
-    SDL_Init(SDL_INIT_EVERYTHING);
-    
-    //SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    //SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-    
-    m_window = SDL_CreateWindow("Dumbstation", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, m_width, m_height, SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL);
+    struct VertexAttribute
+    {
+        const char* name;
+        GLint       size;
+        GLenum      type;
+        size_t      offset;
+    };
     
-    m_gl_context = SDL_GL_CreateContext(m_window);
-    SDL_GL_MakeCurrent(m_window, m_gl_context);
+    //position, colour + flags, texcoord, page, texture window
+    constexpr const VertexAttribute VertexAttributes[] =
+    {
+        { "vertex_position", 2, GL_SHORT,          offsetof(Renderer::Vertex, x)             },
+        { "vertex_color",    4, GL_UNSIGNED_BYTE,  offsetof(Renderer::Vertex, r)             },
+        { "vertex_texcoord", 2, GL_UNSIGNED_BYTE,  offsetof(Renderer::Vertex, u)             },
+        { "vertex_page",     1, GL_UNSIGNED_SHORT, offsetof(Renderer::Vertex, page)          },
+        { "vertex_window",   4, GL_UNSIGNED_BYTE,  offsetof(Renderer::Vertex, window_mask_x) }
+    };
+}
+
+void Renderer::init()
+{
+    if(m_offscreen)
+    {
+        create_offscreen_context();
+    }
+    else
+    {
+        create_window();
+    }
     
     glEnable(GL_TEXTURE_2D);
     glDisable(GL_DEPTH_TEST);
     //glEnable(GL_BLEND);
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
-    //enable vsync
-    SDL_GL_SetSwapInterval(1);
-    
 #if defined __WIN__ || defined __LNX__
     //initialize GLEW
     if(glewInit() != GLEW_OK)
@@ -31,11 +53,29 @@ void Renderer::init()
     
     std::printf("OpenGL version: %s\n", glGetString(GL_VERSION));
     
+    //there is no default framebuffer to present into offscreen
+    if(m_offscreen)
+    {
+        create_display_target();
+    }
+    
     glClearColor(0, 0, 0, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     
+    //primitives are drawn into a VRAM sized texture, the window only gets a copy of it
+    create_vram_target();
+    
+    //primitives are clipped to the drawing area
+    glEnable(GL_SCISSOR_TEST);
+    
     m_primitive_shader.init(m_primitive_shader_vert, m_primitive_shader_frag);
     
+    m_display_shader.init(m_display_shader_vert, m_display_shader_frag);
+    m_display_shader.use();
+    m_display_shader.set1i(0, "vram");
+    
+    resolve_locations();
+    
 	m_primitive_shader.use();
 	
     glGenVertexArrays(1, &m_vao);
@@ -43,28 +83,328 @@ void Renderer::init()
     
     m_vertices.init();
     
-    s32 vert_idx = m_primitive_shader.get_attribute_index("vertex_position");
-    glEnableVertexAttribArray(vert_idx);
-    glVertexAttribIPointer(vert_idx, 2, GL_SHORT, 0, nullptr);
+    vertex_attributes(sizeof(Vertex), 0, 0);
+    
+    //sprites and lines are instanced, their attributes move with every batch and are set up in flush()
+    glGenVertexArrays(1, &m_sprite_vao);
+    glBindVertexArray(m_sprite_vao);
+    m_sprites.init();
+    
+    glGenVertexArrays(1, &m_line_vao);
+    glBindVertexArray(m_line_vao);
+    m_lines.init();
     
-    m_colors.init();
+    m_texture_cache.init();
     
-    s32 col_idx = m_primitive_shader.get_attribute_index("vertex_color");
-    glEnableVertexAttribArray(col_idx);
-    glVertexAttribIPointer(col_idx, 3, GL_UNSIGNED_BYTE, 0, nullptr);
+    //batched primitives may still sample a layer the cache is about to reuse
+    m_texture_cache.on_overwrite([this]() { flush(); });
+    
+    m_primitive_shader.set1i(0, "pages");
+    m_primitive_shader.set1i(1, "mask_snapshot");
     
     glBindVertexArray(0);
 }
 
 void Renderer::clear()
 {
+    m_texture_cache.destroy();
+    destroy_vram_target();
+    glDeleteFramebuffers(1, &m_display_fbo);
+    glDeleteRenderbuffers(1, &m_display_renderbuffer);
     glDeleteVertexArrays(1, &m_vao);
+    glDeleteVertexArrays(1, &m_sprite_vao);
+    glDeleteVertexArrays(1, &m_line_vao);
+    
+#if defined __EGL__
+    if(m_offscreen)
+    {
+        eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_egl_display, m_egl_context);
+        eglTerminate(m_egl_display);
+        return;
+    }
+#endif
+    
     SDL_GL_DeleteContext(m_gl_context);
     SDL_DestroyWindow(m_window);
 }
 
+void Renderer::create_window()
+{
+    SDL_Init(SDL_INIT_EVERYTHING);
+    
+    //SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    //SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    
+    m_window = SDL_CreateWindow("Dumbstation", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, m_width, m_height, SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL);
+    
+    m_gl_context = SDL_GL_CreateContext(m_window);
+    SDL_GL_MakeCurrent(m_window, m_gl_context);
+    
+    //enable vsync until told otherwise
+    SDL_GL_SetSwapInterval(1);
+}
+
+void Renderer::create_offscreen_context()
+{
+#if defined __EGL__
+    //a surfaceless context needs neither a window nor a display server
+    m_egl_display = EGL_NO_DISPLAY;
+    
+#if defined EGL_PLATFORM_SURFACELESS_MESA
+    auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    
+    if(get_platform_display != nullptr)
+    {
+        m_egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+#endif
+    
+    if(m_egl_display == EGL_NO_DISPLAY)
+    {
+        m_egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    
+    const EGLint config_attributes[] =
+    {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    
+    const EGLint context_attributes[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION,       3,
+        EGL_CONTEXT_MINOR_VERSION,       3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    
+    EGLConfig config  = nullptr;
+    EGLint    configs = 0;
+    
+    if(eglInitialize(m_egl_display, nullptr, nullptr) != EGL_TRUE || eglBindAPI(EGL_OPENGL_API) != EGL_TRUE ||
+       eglChooseConfig(m_egl_display, config_attributes, &config, 1, &configs) != EGL_TRUE || configs == 0)
+    {
+        std::printf("Renderer::create_offscreen_context() error: no EGL config for desktop OpenGL (0x%X)\n", eglGetError());
+        std::exit(1);
+    }
+    
+    m_egl_context = eglCreateContext(m_egl_display, config, EGL_NO_CONTEXT, context_attributes);
+    
+    if(m_egl_context == EGL_NO_CONTEXT || eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_egl_context) != EGL_TRUE)
+    {
+        std::printf("Renderer::create_offscreen_context() error: no surfaceless OpenGL 3.3 context (0x%X)\n", eglGetError());
+        std::exit(1);
+    }
+#else
+    //SDL's offscreen driver gets by without a display server where SDL was built with EGL, a hidden window has to do elsewhere
+    if(SDL_VideoInit("offscreen") != 0)
+    {
+        std::printf("Renderer::create_offscreen_context() warning: %s, using a hidden window\n", SDL_GetError());
+        SDL_Init(SDL_INIT_VIDEO);
+    }
+    
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    
+    m_window = SDL_CreateWindow("Dumbstation", 0, 0, m_width, m_height, SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL);
+    
+    m_gl_context = SDL_GL_CreateContext(m_window);
+    
+    if(m_gl_context == nullptr)
+    {
+        std::printf("Renderer::create_offscreen_context() error: %s\n", SDL_GetError());
+        std::exit(1);
+    }
+    
+    SDL_GL_MakeCurrent(m_window, m_gl_context);
+#endif
+}
+
+void Renderer::create_display_target()
+{
+    glGenRenderbuffers(1, &m_display_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_display_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+    
+    glGenFramebuffers(1, &m_display_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_display_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_display_renderbuffer);
+    
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::printf("Renderer::create_display_target() error: display framebuffer is incomplete\n");
+    }
+}
+
+void Renderer::create_vram_target()
+{
+    u32 width  = VRAMWidth  * m_scale;
+    u32 height = VRAMHeight * m_scale;
+    
+    glGenTextures(1, &m_vram_texture);
+    glBindTexture(GL_TEXTURE_2D, m_vram_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, nullptr);
+    
+    glGenTextures(1, &m_staging_texture);
+    glBindTexture(GL_TEXTURE_2D, m_staging_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, VRAMWidth, VRAMHeight, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, nullptr);
+    
+    glGenFramebuffers(1, &m_staging_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_staging_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_staging_texture, 0);
+    
+    glGenFramebuffers(1, &m_vram_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_vram_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_vram_texture, 0);
+    
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::printf("Renderer::create_vram_target() error: VRAM framebuffer is incomplete at %ux\n", m_scale);
+    }
+    
+    glViewport(0, 0, width, height);
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+void Renderer::destroy_vram_target()
+{
+    glDeleteFramebuffers(1, &m_vram_fbo);
+    glDeleteFramebuffers(1, &m_staging_fbo);
+    glDeleteFramebuffers(1, &m_mask_fbo);
+    glDeleteTextures(1, &m_vram_texture);
+    glDeleteTextures(1, &m_staging_texture);
+    glDeleteTextures(1, &m_mask_texture);
+    
+    //the mask snapshot comes back at the new scale when it is next needed
+    m_mask_fbo     = 0;
+    m_mask_texture = 0;
+}
+
+void Renderer::set_resolution_scale(u32 scale)
+{
+    scale = std::clamp<u32>(scale, 1, MaxScale);
+    
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    
+    if(VRAMWidth * scale > u32(max_size))
+    {
+        scale = std::max<u32>(max_size / VRAMWidth, 1);
+        std::printf("Renderer::set_resolution_scale() warning: textures are limited to %d texels, using %ux\n", max_size, scale);
+    }
+    
+    if(scale == m_scale)
+    {
+        return;
+    }
+    
+    //whatever was drawn at the old scale survives through the emulated VRAM
+    flush();
+    resolve_drawn(0, 0, VRAMWidth, VRAMHeight);
+    
+    destroy_vram_target();
+    m_scale = scale;
+    create_vram_target();
+    
+    m_uploads.clear();
+    
+    if(m_vram != nullptr)
+    {
+        m_uploads.push_back({ 0, 0, VRAMWidth, VRAMHeight });
+    }
+}
+
+void Renderer::start_scale_benchmark(u32 frames)
+{
+    m_benchmark = ScaleBenchmark();
+    m_benchmark.frames_per_scale = frames;
+    
+    set_resolution_scale(1);
+    
+    std::printf("Renderer: timing %u frames at every scale from 1x to %ux\n", frames, MaxScale);
+}
+
+void Renderer::benchmark_frame()
+{
+    //offscreen there is no swap to wait on, without this only command submission would be timed
+    glFinish();
+    
+    auto now = std::chrono::steady_clock::now();
+    
+    //the first frame at a scale pays for the new VRAM target and isn't counted
+    if(m_benchmark.frames > 0)
+    {
+        double ms = std::chrono::duration<double, std::milli>(now - m_benchmark.last).count();
+        
+        m_benchmark.total_ms += ms;
+        m_benchmark.worst_ms  = std::max(m_benchmark.worst_ms, ms);
+    }
+    
+    m_benchmark.last = now;
+    
+    if(m_benchmark.frames++ < m_benchmark.frames_per_scale)
+    {
+        return;
+    }
+    
+    double average = m_benchmark.total_ms / m_benchmark.frames_per_scale;
+    bool   holds   = average <= 1000.0 / 60.0;
+    
+    std::printf("Renderer: %ux (%ux%u) %.2f ms average, %.2f ms worst, %.1f fps%s\n",
+                m_scale, VRAMWidth * m_scale, VRAMHeight * m_scale,
+                average, m_benchmark.worst_ms, 1000.0 / average, holds ? "" : ", below 60 fps");
+    
+    if(holds)
+    {
+        m_benchmark.best_scale = m_scale;
+    }
+    
+    if(m_scale < MaxScale)
+    {
+        u32 previous = m_scale;
+        
+        set_resolution_scale(m_scale + 1);
+        
+        //the texture size limit got in the way, nothing left to try
+        if(m_scale != previous)
+        {
+            m_benchmark.frames   = 0;
+            m_benchmark.total_ms = 0.0;
+            m_benchmark.worst_ms = 0.0;
+            return;
+        }
+    }
+    
+    if(m_benchmark.best_scale == 0)
+    {
+        std::printf("Renderer: no scale holds 60 fps\n");
+    }
+    else
+    {
+        std::printf("Renderer: highest scale holding 60 fps is %ux\n", m_benchmark.best_scale);
+    }
+    
+    std::exit(0);
+}
+
 void Renderer::poll_events()
 {
+    //nobody can close a window that isn't there
+    if(m_offscreen)
+    {
+        return;
+    }
+    
     static SDL_Event e;
     
     while(SDL_PollEvent(&e))
@@ -77,68 +417,662 @@ void Renderer::poll_events()
     }
 }
 
-void Renderer::draw_shaded_triangle(Vertex (&vertices)[3], Color (&colors)[3])
+void Renderer::acquire_context()
 {
-	if(m_vertices_count + 3 >= VertexBufferLength)
-	{
-		draw();
-	}
-	
-    m_vertices[m_vertices_count] = vertices[0];
-    m_colors[m_vertices_count++] = colors[0];
-    m_vertices[m_vertices_count] = vertices[1];
-    m_colors[m_vertices_count++] = colors[1];
-    m_vertices[m_vertices_count] = vertices[2];
-    m_colors[m_vertices_count++] = colors[2];
+#if defined __EGL__
+    if(m_offscreen)
+    {
+        eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_egl_context);
+        return;
+    }
+#endif
+    
+    SDL_GL_MakeCurrent(m_window, m_gl_context);
 }
 
-void Renderer::draw_shaded_quad(Vertex (&vertices)[4], Color (&colors)[4])
+void Renderer::release_context()
 {
-	if(m_vertices_count + 6 >= VertexBufferLength)
-	{
-		draw();
-	}
-	
-	m_vertices[m_vertices_count] = vertices[0];
-    m_colors[m_vertices_count++] = colors[0];
-    m_vertices[m_vertices_count] = vertices[1];
-    m_colors[m_vertices_count++] = colors[1];
-    m_vertices[m_vertices_count] = vertices[2];
-    m_colors[m_vertices_count++] = colors[2];
-	
-	
-	m_vertices[m_vertices_count] = vertices[1];
-    m_colors[m_vertices_count++] = colors[1];
-    m_vertices[m_vertices_count] = vertices[2];
-    m_colors[m_vertices_count++] = colors[2];
-    m_vertices[m_vertices_count] = vertices[3];
-    m_colors[m_vertices_count++] = colors[3];
+#if defined __EGL__
+    if(m_offscreen)
+    {
+        eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        return;
+    }
+#endif
+    
+    SDL_GL_MakeCurrent(m_window, nullptr);
 }
 
-void Renderer::set_draw_offset(s16 x, s16 y)
+void Renderer::poll_events_after_present()
 {
-	draw();
-	
-	m_primitive_shader.set2i(glm::vec2(x, y), "offset");
+    if(m_presented.load(std::memory_order_relaxed) && m_presented.exchange(false))
+    {
+        poll_events();
+    }
 }
 
-void Renderer::draw()
+void Renderer::resolve_locations()
 {
-    poll_events();
-	
+    static_assert(std::size(VertexAttributes) == sizeof(PrimitiveLocations::vertex) / sizeof(GLint));
+    
+    for(u32 i = 0; i < std::size(VertexAttributes); i++)
+    {
+        m_primitive_locations.vertex[i] = m_primitive_shader.get_attribute_index(VertexAttributes[i].name);
+    }
+    
+    m_primitive_locations.sprite_size       = m_primitive_shader.get_attribute_index("sprite_size");
+    m_primitive_locations.line_end_position = m_primitive_shader.get_attribute_index("line_end_position");
+    m_primitive_locations.line_end_color    = m_primitive_shader.get_attribute_index("line_end_color");
+    
+    m_primitive_locations.shape      = m_primitive_shader.uniform("shape");
+    m_primitive_locations.pass       = m_primitive_shader.uniform("pass");
+    m_primitive_locations.check_mask = m_primitive_shader.uniform("check_mask");
+    m_primitive_locations.dither     = m_primitive_shader.uniform("dither");
+    m_primitive_locations.scale      = m_primitive_shader.uniform("scale");
+    
+    m_display_locations.origin  = m_display_shader.uniform("origin");
+    m_display_locations.size    = m_display_shader.uniform("size");
+    m_display_locations.factor  = m_display_shader.uniform("factor");
+    m_display_locations.scale   = m_display_shader.uniform("scale");
+    m_display_locations.depth24 = m_display_shader.uniform("depth24");
+}
+
+void Renderer::vertex_attributes(GLsizei stride, uintptr_t base, GLuint divisor)
+{
+    for(u32 i = 0; i < std::size(VertexAttributes); i++)
+    {
+        const VertexAttribute& attribute = VertexAttributes[i];
+        GLint                  index     = m_primitive_locations.vertex[i];
+        
+        glEnableVertexAttribArray(index);
+        glVertexAttribIPointer(index, attribute.size, attribute.type, stride, reinterpret_cast<void*>(base + attribute.offset));
+        glVertexAttribDivisor(index, divisor);
+    }
+}
+
+u32 Renderer::available(Shape shape) const
+{
+    switch(shape)
+    {
+        case Shape::Sprites: { return m_sprites.available(); }
+        case Shape::Lines:   { return m_lines.available(); }
+        default:             { return m_vertices.available(); }
+    }
+}
+
+u32 Renderer::batch_count() const
+{
+    switch(m_shape)
+    {
+        case Shape::Sprites: { return m_sprites.batch_count(); }
+        case Shape::Lines:   { return m_lines.batch_count(); }
+        default:             { return m_vertices.batch_count(); }
+    }
+}
+
+void Renderer::use_state(const DrawState& state, Shape shape, u32 count)
+{
+    if(!(state == m_state) || shape != m_shape || available(shape) < count)
+    {
+        flush();
+    }
+    
+    //the segment is full, carry on in the next one once the GPU is done with it
+    if(available(shape) < count)
+    {
+        switch(shape)
+        {
+            case Shape::Sprites: { m_sprites.next_segment(); break; }
+            case Shape::Lines:   { m_lines.next_segment(); break; }
+            default:             { m_vertices.next_segment(); break; }
+        }
+    }
+    
+    m_state = state;
+    m_shape = shape;
+}
+
+void Renderer::check_mask_writes(const DrawState& state, u8 flags, const Bounds& area)
+{
+    if(!state.check_mask)
+    {
+        return;
+    }
+    
+    if(m_batch_mask_written.overlaps(area))
+    {
+        flush();
+    }
+    
+    //untextured primitives write a clear mask bit, which the test only lets through onto clear bits
+    if(flags & (Vertex::ForceMask | Vertex::Textured))
+    {
+        m_batch_mask_written.merge(area);
+    }
+}
+
+void Renderer::draw_triangle(const Vertex (&vertices)[3], const DrawState& state)
+{
+    Bounds area = bounds(vertices, 3);
+    
+    use_state(state, Shape::Triangles, 3);
+    check_mask_writes(state, vertices[0].flags, area);
+    
+    for(const Vertex& vertex : vertices)
+    {
+        m_vertices.push() = vertex;
+    }
+    
+    mark_drawn(area);
+}
+
+void Renderer::draw_quad(const Vertex (&vertices)[4], const DrawState& state)
+{
+    Bounds area = bounds(vertices, 4);
+    
+    use_state(state, Shape::Triangles, 6);
+    check_mask_writes(state, vertices[0].flags, area);
+    
+    //first triangle 0-1-2, second triangle 1-2-3
+    for(u32 i : { 0, 1, 2, 1, 2, 3 })
+    {
+        m_vertices.push() = vertices[i];
+    }
+    
+    mark_drawn(area);
+}
+
+void Renderer::draw_rectangle(const Sprite& sprite, const DrawState& state)
+{
+    if(sprite.width == 0 || sprite.height == 0)
+    {
+        return;
+    }
+    
+    Bounds area = { sprite.origin.x, sprite.origin.y, sprite.origin.x + sprite.width - 1, sprite.origin.y + sprite.height - 1 };
+    
+    use_state(state, Shape::Sprites, 1);
+    check_mask_writes(state, sprite.origin.flags, area);
+    
+    m_sprites.push() = sprite;
+    
+    mark_drawn(area);
+}
+
+void Renderer::draw_line(const Line& line, const DrawState& state)
+{
+    Bounds area = bounds(&line.from, 2);
+    
+    use_state(state, Shape::Lines, 1);
+    check_mask_writes(state, line.from.flags, area);
+    
+    m_lines.push() = line;
+    
+    mark_drawn(area);
+}
+
+Renderer::Bounds Renderer::bounds(const Vertex* vertices, u32 count)
+{
+    Bounds area = { vertices[0].x, vertices[0].y, vertices[0].x, vertices[0].y };
+    
+    for(u32 i = 1; i < count; i++)
+    {
+        area.left   = std::min<s32>(area.left,   vertices[i].x);
+        area.right  = std::max<s32>(area.right,  vertices[i].x);
+        area.top    = std::min<s32>(area.top,    vertices[i].y);
+        area.bottom = std::max<s32>(area.bottom, vertices[i].y);
+    }
+    
+    return area;
+}
+
+void Renderer::mark_drawn(const Bounds& area)
+{
+    s32 left   = std::max<s32>(area.left, 0);
+    s32 top    = std::max<s32>(area.top,  0);
+    s32 right  = std::min<s32>(area.right,  VRAMWidth  - 1);
+    s32 bottom = std::min<s32>(area.bottom, VRAMHeight - 1);
+    
+    for(s32 ty = top / s32(TileSize); ty <= bottom / s32(TileSize); ty++)
+    {
+        for(s32 tx = left / s32(TileSize); tx <= right / s32(TileSize); tx++)
+        {
+            m_drawn[ty][tx] = true;
+        }
+    }
+}
+
+u16 Renderer::texture_page(u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y)
+{
+    //render to texture, whatever was drawn into the page or palette has to be in VRAM before it is decoded
+    resolve_drawn(texpage_x, texpage_y, 64 << std::min<u8>(depth, 2), 256);
+    
+    if(depth < 2)
+    {
+        resolve_drawn(clut_x, clut_y, depth == 0 ? 16 : 256, 1);
+    }
+    
+    return m_texture_cache.lookup(m_vram, texpage_x, texpage_y, depth, clut_x, clut_y);
+}
+
+void Renderer::clear_texture_cache()
+{
+    flush();
+    m_texture_cache.clear();
+}
+
+void Renderer::write_vram(u16 x, u16 y, u16 width, u16 height)
+{
+    if(width == 0 || height == 0)
+    {
+        return;
+    }
+    
+    //batched primitives came first and must not land on top of the new data
+    flush();
+    
+    m_texture_cache.invalidate(x, y, width, height);
+    
+    //image loads come in a row at a time, grow the last rectangle while they line up
+    if(!m_uploads.empty())
+    {
+        Rect& last = m_uploads.back();
+        
+        if(last.x == x && last.width == width && last.y + last.height == y)
+        {
+            last.height += height;
+            return;
+        }
+    }
+    
+    m_uploads.push_back({ x, y, width, height });
+}
+
+void Renderer::upload_vram()
+{
+    if(m_uploads.empty())
+    {
+        return;
+    }
+    
+    //scaled targets can't take native pixels directly, they go through the staging texture
+    glBindTexture(GL_TEXTURE_2D, m_scale == 1 ? m_vram_texture : m_staging_texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, VRAMWidth);
+    
+    for(const Rect& rect : m_uploads)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_vram + rect.y * VRAMWidth + rect.x);
+    }
+    
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    
+    if(m_scale > 1)
+    {
+        //every uploaded pixel becomes a scale x scale block
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_staging_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_vram_fbo);
+        
+        for(const Rect& rect : m_uploads)
+        {
+            glBlitFramebuffer(rect.x, rect.y, rect.x + rect.width, rect.y + rect.height,
+                              rect.x * m_scale, rect.y * m_scale, (rect.x + rect.width) * m_scale, (rect.y + rect.height) * m_scale,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, m_vram_fbo);
+        glEnable(GL_SCISSOR_TEST);
+    }
+    
+    m_uploads.clear();
+}
+
+void Renderer::resolve_drawn(u16 x, u16 y, u16 width, u16 height)
+{
+    //whole tiles are read back so that their drawn flag can go
+    u32 first_x = x / TileSize;
+    u32 last_x  = (x + width - 1) / TileSize;
+    u32 first_y = y / TileSize;
+    u32 last_y  = std::min<u32>((y + height - 1) / TileSize, TilesY - 1);
+    
+    for(u32 ty = first_y; ty <= last_y; ty++)
+    {
+        for(u32 i = first_x; i <= last_x; i++)
+        {
+            u32 tx = i % TilesX;
+            
+            if(!m_drawn[ty][tx])
+            {
+                continue;
+            }
+            
+            if(batch_count() > 0 || !m_uploads.empty())
+            {
+                flush();
+                upload_vram();
+            }
+            
+            Rect tile = { static_cast<u16>(tx * TileSize), static_cast<u16>(ty * TileSize), TileSize, TileSize };
+            
+            read_vram(tile, m_vram);
+            m_texture_cache.invalidate(tile.x, tile.y, tile.width, tile.height);
+            
+            m_drawn[ty][tx] = false;
+        }
+    }
+}
+
+void Renderer::download_vram(u16 x, u16 y, u16 width, u16 height, u16* vram)
+{
+    flush();
+    upload_vram();
+    
+    //the region wraps around both edges of VRAM
+    u16 first_width   = std::min<u32>(width,  VRAMWidth  - x);
+    u16 first_height  = std::min<u32>(height, VRAMHeight - y);
+    u16 second_width  = width  - first_width;
+    u16 second_height = height - first_height;
+    
+    const Rect rects[4] =
+    {
+        { x, y, first_width,  first_height  },
+        { 0, y, second_width, first_height  },
+        { x, 0, first_width,  second_height },
+        { 0, 0, second_width, second_height }
+    };
+    
+    for(const Rect& rect : rects)
+    {
+        if(rect.width != 0 && rect.height != 0)
+        {
+            read_vram(rect, vram);
+            m_texture_cache.invalidate(rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+}
+
+void Renderer::read_vram(const Rect& rect, u16* vram)
+{
+    if(m_scale > 1)
+    {
+        //integer downsample into the staging texture, nearest keeps one texel of every block
+        //instead of averaging so that mask bits and palette indices drawn into VRAM survive
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_vram_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_staging_fbo);
+        glBlitFramebuffer(rect.x * m_scale, rect.y * m_scale, (rect.x + rect.width) * m_scale, (rect.y + rect.height) * m_scale,
+                          rect.x, rect.y, rect.x + rect.width, rect.y + rect.height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_staging_fbo);
+    }
+    
+    glPixelStorei(GL_PACK_ROW_LENGTH, VRAMWidth);
+    glReadPixels(rect.x, rect.y, rect.width, rect.height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, vram + rect.y * VRAMWidth + rect.x);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    
+    if(m_scale > 1)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_vram_fbo);
+        glEnable(GL_SCISSOR_TEST);
+    }
+}
+
+void Renderer::apply_state()
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture_cache.texture());
+    
+    glScissor(m_state.clip_left * m_scale, m_state.clip_top * m_scale,
+              std::max(m_state.clip_right  - m_state.clip_left + 1, 0) * m_scale,
+              std::max(m_state.clip_bottom - m_state.clip_top  + 1, 0) * m_scale);
+    
+    //every fragment weighs itself and the destination through its second output,
+    //alpha is the mask bit and is written as is
+    glEnable(GL_BLEND);
+    glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+    glBlendFuncSeparate(GL_ONE, GL_SRC1_COLOR, GL_ONE, GL_ZERO);
+    
+    m_primitive_shader.set1i(0, m_primitive_locations.pass);
+    m_primitive_shader.set1i(m_state.check_mask ? 1 : 0, m_primitive_locations.check_mask);
+    m_primitive_shader.set1i(m_state.dither ? 1 : 0, m_primitive_locations.dither);
+    m_primitive_shader.set1i(m_scale, m_primitive_locations.scale);
+    
+    if(m_state.check_mask)
+    {
+        snapshot_mask();
+    }
+}
+
+void Renderer::snapshot_mask()
+{
+    if(m_mask_texture == 0)
+    {
+        glGenTextures(1, &m_mask_texture);
+        glBindTexture(GL_TEXTURE_2D, m_mask_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, VRAMWidth * m_scale, VRAMHeight * m_scale, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, nullptr);
+        
+        glGenFramebuffers(1, &m_mask_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_mask_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_mask_texture, 0);
+    }
+    
+    //the scissor already covers the drawing area, primitives of one batch only see the mask bits from before it
+    s32 left   = m_state.clip_left * m_scale;
+    s32 top    = m_state.clip_top  * m_scale;
+    s32 right  = std::max<s32>(m_state.clip_right  + 1, m_state.clip_left) * m_scale;
+    s32 bottom = std::max<s32>(m_state.clip_bottom + 1, m_state.clip_top)  * m_scale;
+    
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_vram_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_mask_fbo);
+    glBlitFramebuffer(left, top, right, bottom, left, top, right, bottom, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_vram_fbo);
+    
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_mask_texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Renderer::flush()
+{
+    u32 count = batch_count();
+    
+    if(count == 0)
+    {
+        return;
+    }
+    
+    m_batch_mask_written = Bounds();
+    
+    upload_vram();
+    
 	m_primitive_shader.use();
-    glBindVertexArray(m_vao);
-	//m_vertices.use();
-	//m_colors.use();
-	
-    glDrawArrays(GL_TRIANGLES, 0, m_vertices_count);
+    apply_state();
+    m_primitive_shader.set1i(static_cast<int>(m_shape), m_primitive_locations.shape);
+    
+    switch(m_shape)
+    {
+        case Shape::Triangles:
+        {
+            u32 first = m_vertices.batch_first();
+            
+            m_vertices.submit_batch();
+            
+            glBindVertexArray(m_vao);
+            draw_passes(first, count, false);
+            break;
+        }
+        case Shape::Sprites:
+        {
+            u32 first = m_sprites.batch_first();
+            
+            m_sprites.submit_batch();
+            
+            //no base instance in GL 3.3, the attributes start at the batch instead
+            glBindVertexArray(m_sprite_vao);
+            m_sprites.use();
+            vertex_attributes(sizeof(Sprite), first * sizeof(Sprite) + offsetof(Sprite, origin), 1);
+            
+            s32 size_idx = m_primitive_locations.sprite_size;
+            glEnableVertexAttribArray(size_idx);
+            glVertexAttribIPointer(size_idx, 2, GL_UNSIGNED_SHORT, sizeof(Sprite), reinterpret_cast<void*>(first * sizeof(Sprite) + offsetof(Sprite, width)));
+            glVertexAttribDivisor(size_idx, 1);
+            
+            draw_passes(0, count, true);
+            break;
+        }
+        case Shape::Lines:
+        {
+            u32 first = m_lines.batch_first();
+            
+            m_lines.submit_batch();
+            
+            glBindVertexArray(m_line_vao);
+            m_lines.use();
+            vertex_attributes(sizeof(Line), first * sizeof(Line) + offsetof(Line, from), 1);
+            
+            s32 end_idx = m_primitive_locations.line_end_position;
+            glEnableVertexAttribArray(end_idx);
+            glVertexAttribIPointer(end_idx, 2, GL_SHORT, sizeof(Line), reinterpret_cast<void*>(first * sizeof(Line) + offsetof(Line, to) + offsetof(Vertex, x)));
+            glVertexAttribDivisor(end_idx, 1);
+            
+            s32 end_col_idx = m_primitive_locations.line_end_color;
+            glEnableVertexAttribArray(end_col_idx);
+            glVertexAttribIPointer(end_col_idx, 4, GL_UNSIGNED_BYTE, sizeof(Line), reinterpret_cast<void*>(first * sizeof(Line) + offsetof(Line, to) + offsetof(Vertex, r)));
+            glVertexAttribDivisor(end_col_idx, 1);
+            
+            draw_passes(0, count, true);
+            break;
+        }
+    }
     
-	//m_colors.unuse();
-	//m_vertices.unuse();
 	glBindVertexArray(0);
 	m_primitive_shader.unuse();
-	    
-    m_vertices_count = 0;
+}
+
+void Renderer::draw_passes(u32 first, u32 count, bool instanced)
+{
+    //reverse subtraction can't leave opaque texels alone, those go first with the usual equation
+    u32 passes = m_state.subtract ? 2 : 1;
     
-    SDL_GL_SwapWindow(m_window);
+    for(u32 pass = 0; pass < passes; pass++)
+    {
+        if(m_state.subtract)
+        {
+            m_primitive_shader.set1i(pass + 1, m_primitive_locations.pass);
+            glBlendEquationSeparate(pass == 0 ? GL_FUNC_ADD : GL_FUNC_REVERSE_SUBTRACT, GL_FUNC_ADD);
+        }
+        
+        if(instanced)
+        {
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, first, count);
+        }
+    }
+}
+
+void Renderer::set_frame_pacing(Config::FramePacing pacing)
+{
+    //nothing waits for a display that isn't there
+    if(m_offscreen)
+    {
+        return;
+    }
+    
+    switch(pacing)
+    {
+        case Config::FramePacing::VSync:
+        {
+            SDL_GL_SetSwapInterval(1);
+            break;
+        }
+        case Config::FramePacing::Mailbox:
+        {
+            //GL has no real mailbox, adaptive vsync at least tears instead of waiting a whole refresh for late frames
+            if(SDL_GL_SetSwapInterval(-1) != 0)
+            {
+                std::printf("Renderer::set_frame_pacing() warning: adaptive vsync unsupported, using vsync\n");
+                SDL_GL_SetSwapInterval(1);
+            }
+            
+            break;
+        }
+        case Config::FramePacing::Uncapped:
+        {
+            SDL_GL_SetSwapInterval(0);
+            break;
+        }
+    }
+}
+
+void Renderer::present(u16 x, u16 y, u16 width, u16 height, bool depth24)
+{
+    if(m_poll_in_draw)
+    {
+        poll_events();
+    }
+    
+    flush();
+    upload_vram();
+    
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_display_fbo);
+    glViewport(0, 0, m_width, m_height);
+    
+    //24 bit rows are read byte by byte and wrap around VRAM instead
+    width  = std::min<u32>(width,  depth24 ? VRAMWidth : VRAMWidth - x);
+    height = std::min<u32>(height, VRAMHeight - y);
+    
+    if(width == 0 || height == 0)
+    {
+        glClearColor(0, 0, 0, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    else
+    {
+        //shrink by the largest divisor of the scale that still leaves at least a window's worth of pixels
+        u32 factor = std::clamp<u32>(std::min(width * m_scale / m_width, height * m_scale / m_height), 1, m_scale);
+        
+        while(m_scale % factor != 0)
+        {
+            factor--;
+        }
+        
+        glDisable(GL_BLEND);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_vram_texture);
+        
+        m_display_shader.use();
+        m_display_shader.set2i(glm::ivec2(x * m_scale, y * m_scale), m_display_locations.origin);
+        m_display_shader.set2i(glm::ivec2(width * m_scale, height * m_scale), m_display_locations.size);
+        m_display_shader.set1i(factor, m_display_locations.factor);
+        m_display_shader.set1i(m_scale, m_display_locations.scale);
+        m_display_shader.set1i(depth24 ? 1 : 0, m_display_locations.depth24);
+        
+        glBindVertexArray(m_vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindVertexArray(0);
+        
+        m_display_shader.unuse();
+    }
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, m_vram_fbo);
+    glViewport(0, 0, VRAMWidth * m_scale, VRAMHeight * m_scale);
+    glEnable(GL_SCISSOR_TEST);
+    
+    if(!m_offscreen)
+    {
+        SDL_GL_SwapWindow(m_window);
+    }
+    
+    m_presented.store(true, std::memory_order_release);
+    
+    if(m_benchmark.frames_per_scale != 0)
+    {
+        benchmark_frame();
+    }
 }
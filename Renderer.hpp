@@ -3,6 +3,8 @@
 #include "Types.hpp"
 #include "GLBuffer.hpp"
 #include "ShaderProgram.hpp"
+#include "TextureCache.hpp"
+#include "Config.hpp"
 
 #if defined  __WIN__
 #define NOMINMAX
@@ -21,46 +23,97 @@
 #include <SDL2/SDL.h>
 #endif
 
+#if defined __EGL__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <vector>
 
 class Renderer
 {
 public:
 
-	static constexpr const u32 VertexBufferLength = 64 * 1024;
+	static constexpr const u32 VertexBufferLength = 3 * 16 * 1024;
+    static constexpr const u32 SpriteBufferLength = 3 * 4 * 1024;
+    static constexpr const u32 LineBufferLength   = 3 * 1024;
+    static constexpr const u32 VRAMWidth          = 1024;
+    static constexpr const u32 VRAMHeight         = 512;
+    static constexpr const u32 MaxScale           = 8;
     
+    /**
+     * one interleaved 16 byte vertex shared by every primitive type, unpacked by the vertex shader
+     */
     struct Vertex
     {
-        Vertex() {}
-        Vertex(s16 x, s16 y) : x(x), y(y) {}
-        Vertex(u32 packed)
+        enum Flags : u8
         {
-            x = (packed >>  0) & 0xFFFF;
-            y = (packed >> 16) & 0xFFFF;
-        }
+            Textured        = 1 << 0,
+            RawTexture      = 1 << 1,
+            FlipX           = 1 << 2, // sprites only
+            FlipY           = 1 << 3,
+            SemiTransparent = 1 << 4, // blended the Blend way in the next two bits
+            BlendMode       = 3 << 5,
+            ForceMask       = 1 << 7  // mask bit set whatever the texel says
+        };
+        
+        enum Blend : u8
+        {
+            Average    = 0, // B / 2 + F / 2
+            Add        = 1, // B + F
+            Subtract   = 2, // B - F
+            AddQuarter = 3  // B + F / 4
+        };
+        
+        static constexpr const u8 BlendShift = 5;
         
         s16 x { 0 };
         s16 y { 0 };
+        
+        u8  r     { 0 };
+        u8  g     { 0 };
+        u8  b     { 0 };
+        u8  flags { 0 };
+        
+        u8  u    { 0 };
+        u8  v    { 0 };
+        u16 page { 0 }; // texture cache layer
+        
+        //texture window in units of 8 texels
+        u8  window_mask_x   { 0 };
+        u8  window_mask_y   { 0 };
+        u8  window_offset_x { 0 };
+        u8  window_offset_y { 0 };
     };
     
-    struct Color
+    static_assert(sizeof(Vertex) == 16);
+    
+    /**
+     * instance record of an axis aligned sprite, the vertex shader builds the quad
+     */
+    struct Sprite
     {
-        Color() {}
-        Color(u8 r, u8 g, u8 b) : r(r), g(g), b(b) {}
-        Color(u32 packed)
-        {
-            r = (packed >>  0) & 0xFF;
-            g = (packed >>  8) & 0xFF;
-            b = (packed >> 16) & 0xFF;
-        }
-        
-        u8 r { 0 };
-        u8 g { 0 };
-        u8 b { 0 };
+        Vertex origin; // top left pixel, its colour and texcoord
+        u16    width  { 0 };
+        u16    height { 0 };
+    };
+    
+    /**
+     * instance record of a line, the vertex shader widens it into a one pixel thick quad
+     */
+    struct Line
+    {
+        Vertex from;
+        Vertex to;
     };
     
     Renderer() { init(); }
-    Renderer(u16 width, u16 height) : m_width(width), m_height(height) { init(); }
+    Renderer(u16 width, u16 height, bool offscreen = false) : m_width(width), m_height(height), m_offscreen(offscreen) { init(); }
     ~Renderer() { clear(); }
     
     
@@ -68,39 +121,491 @@ public:
     void clear();
     void poll_events();
     
-    void draw_shaded_triangle(Vertex (&vertices)[3], Color (&colors)[3]);
-	void draw_shaded_quad(Vertex (&vertices)[4], Color (&colors)[4]);
+    /**
+     * offscreen renderers have no window, present() draws into a window sized framebuffer of their own
+     */
+    bool offscreen() const { return m_offscreen; }
     
-	void set_draw_offset(s16 x, s16 y);
+    /**
+     * make the GL context current on the calling thread, it has to be released on the old one first
+     */
+    void acquire_context();
+    void release_context();
+    
+    /**
+     * window events belong to the thread which created the window, when draw() runs
+     * elsewhere that thread pumps them through poll_events_after_present() instead
+     */
+    void set_event_polling(bool in_draw) { m_poll_in_draw = in_draw; }
+    void poll_events_after_present();
+    
+    /**
+     * everything a batch shares, primitives with equal states end up in the same draw call,
+     * blend modes and the forced mask bit come with the vertices instead
+     */
+    struct DrawState
+    {
+        //subtraction needs its own blend equation, every other mode shares one
+        bool subtract   { false };
+        bool check_mask { false };
+        bool dither     { false }; // only set for primitives the GPU dithers
+        
+        //drawing area, inclusive
+        s16 clip_left   { 0 };
+        s16 clip_top    { 0 };
+        s16 clip_right  { VRAMWidth  - 1 };
+        s16 clip_bottom { VRAMHeight - 1 };
+        
+        bool operator==(const DrawState& other) const
+        {
+            return subtract   == other.subtract   && check_mask  == other.check_mask  &&
+                   dither     == other.dither     &&
+                   clip_left  == other.clip_left  && clip_top    == other.clip_top    &&
+                   clip_right == other.clip_right && clip_bottom == other.clip_bottom;
+        }
+    };
+    
+    /**
+     * vertices come with the drawing offset already applied, a batch is only submitted
+     * when the state changes or the vertex buffer fills, texture pages live in the vertices
+     */
+    void draw_triangle(const Vertex (&vertices)[3], const DrawState& state);
+    void draw_quad(const Vertex (&vertices)[4], const DrawState& state);
+    void draw_rectangle(const Sprite& sprite, const DrawState& state);
+    void draw_line(const Line& line, const DrawState& state);
+    
+    /**
+     * texture cache layer of a decoded page, anything drawn into its source is read back first
+     */
+    u16 texture_page(u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y);
+    
+    /**
+     * forget every decoded page, the batch using them is drawn first
+     */
+    void clear_texture_cache();
+    
+    /**
+     * the emulated VRAM, the VRAM texture mirrors it
+     */
+    void attach_vram(u16* vram) { m_vram = vram; }
+    
+    /**
+     * CPU side VRAM write, uploaded before the VRAM texture is next drawn to or shown
+     */
+    void write_vram(u16 x, u16 y, u16 width, u16 height);
 	
-    void draw();
+	/**
+	 * copy a region the renderer may have drawn into back to the emulated VRAM
+	 */
+	void download_vram(u16 x, u16 y, u16 width, u16 height, u16* vram);
+	
+    /**
+     * swap interval used by present()
+     */
+    void set_frame_pacing(Config::FramePacing pacing);
+    
+    /**
+     * submit everything batched and show a VRAM rectangle scaled to the window,
+     * an empty rectangle blanks the window, in 24 bit mode width counts RGB888 pixels
+     */
+    void present(u16 x, u16 y, u16 width, u16 height, bool depth24 = false);
+    
+    /**
+     * internal resolution as a multiple of the native VRAM size, the emulated VRAM
+     * stays native and only sees the drawn pixels through an integer downsample
+     */
+    void set_resolution_scale(u32 scale);
+    u32  resolution_scale() const { return m_scale; }
+    
+    /**
+     * time the given number of presents at every scale from 1x to MaxScale, then exit
+     */
+    void start_scale_benchmark(u32 frames);
     
 private:
     
+    /**
+     * submit the batched vertices without presenting
+     */
+    void flush();
+    void apply_state();
+    
+    /**
+     * issue the batch's draw call, twice for subtractive batches
+     */
+    void draw_passes(u32 first, u32 count, bool instanced);
+    
+    /**
+     * what the current batch is made of, each kind has its own buffer and draw call
+     */
+    enum class Shape : u8
+    {
+        Triangles,
+        Sprites,
+        Lines
+    };
+    
+    void use_state(const DrawState& state, Shape shape, u32 count);
+    u32  available(Shape shape) const;
+    u32  batch_count() const;
+    
+    /**
+     * look up the uniform and attribute locations flush() and present() use
+     */
+    void resolve_locations();
+    
+    /**
+     * point the Vertex attributes of the bound VAO at base in the bound buffer
+     */
+    void vertex_attributes(GLsizei stride, uintptr_t base, GLuint divisor);
+    
+    /**
+     * VRAM rectangle, never wraps
+     */
+    struct Rect
+    {
+        u16 x;
+        u16 y;
+        u16 width;
+        u16 height;
+    };
+    
+    /**
+     * inclusive bounding box of a primitive, may reach past the edges of VRAM
+     */
+    struct Bounds
+    {
+        s32 left   { 0 };
+        s32 top    { 0 };
+        s32 right  { -1 };
+        s32 bottom { -1 };
+        
+        bool empty() const { return left > right || top > bottom; }
+        
+        bool overlaps(const Bounds& other) const
+        {
+            return left <= other.right && other.left <= right && top <= other.bottom && other.top <= bottom;
+        }
+        
+        void merge(const Bounds& other)
+        {
+            if(empty())
+            {
+                *this = other;
+                return;
+            }
+            
+            left   = std::min(left,   other.left);
+            top    = std::min(top,    other.top);
+            right  = std::max(right,  other.right);
+            bottom = std::max(bottom, other.bottom);
+        }
+    };
+    
+    static Bounds bounds(const Vertex* vertices, u32 count);
+    
+    /**
+     * the mask test reads a snapshot from before the batch, a primitive over mask bits
+     * set earlier in the same batch has to start a new one
+     */
+    void check_mask_writes(const DrawState& state, u8 flags, const Bounds& area);
+    
+    //primitives only mark the 64x64 tiles their bounding box covers as drawn
+    static constexpr const u32 TileSize = 64;
+    static constexpr const u32 TilesX   = VRAMWidth  / TileSize;
+    static constexpr const u32 TilesY   = VRAMHeight / TileSize;
+    
+    void create_window();
+    void create_offscreen_context();
+    void create_display_target();
+    
+    void create_vram_target();
+    void destroy_vram_target();
+    
+    /**
+     * copy the drawing area for a batch which must not draw over masked pixels
+     */
+    void snapshot_mask();
+    
+    void benchmark_frame();
+    
+    void upload_vram();
+    void mark_drawn(const Bounds& area);
+    void resolve_drawn(u16 x, u16 y, u16 width, u16 height);
+    void read_vram(const Rect& rect, u16* vram);
+    
     u16 m_width  { 1024 };
     u16 m_height {  512 };
     
     SDL_Window*   m_window { nullptr };
     SDL_GLContext m_gl_context;
     
-    GLuint m_vao { 0 };
-    u32 m_vertices_count { 0 };
+    //without a window present() targets m_display_fbo, 0 is the window's framebuffer
+    bool   m_offscreen            { false };
+    GLuint m_display_fbo          { 0 };
+    GLuint m_display_renderbuffer { 0 };
+    
+#if defined __EGL__
+    EGLDisplay m_egl_display { EGL_NO_DISPLAY };
+    EGLContext m_egl_context { EGL_NO_CONTEXT };
+#endif
+    
+    bool              m_poll_in_draw { true };
+    std::atomic<bool> m_presented    { false };
+    
+    GLuint m_vao        { 0 };
+    GLuint m_sprite_vao { 0 };
+    GLuint m_line_vao   { 0 };
     
     GLBuffer<Vertex, VertexBufferLength> m_vertices;
-    GLBuffer<Color, VertexBufferLength>  m_colors;
+    GLBuffer<Sprite, SpriteBufferLength> m_sprites;
+    GLBuffer<Line,   LineBufferLength>   m_lines;
+    
+    TextureCache m_texture_cache;
+    
+    //state of the batch being built
+    DrawState    m_state;
+    Shape        m_shape { Shape::Triangles };
+    
+    //where the batch may have set mask bits, only tracked while it checks the mask
+    Bounds       m_batch_mask_written;
+    
+    //VRAM texture and the framebuffer drawing into it, m_scale times the native size
+    u16*              m_vram         { nullptr };
+    u32               m_scale        { 1 };
+    GLuint            m_vram_texture { 0 };
+    GLuint            m_vram_fbo     { 0 };
+    std::vector<Rect> m_uploads;
+    bool              m_drawn[TilesY][TilesX] {};
+    
+    //native sized go-between for uploads and readbacks when scaled
+    GLuint m_staging_texture { 0 };
+    GLuint m_staging_fbo     { 0 };
+    
+    //scaled copy of VRAM the mask test reads, created the first time it is needed
+    GLuint m_mask_texture { 0 };
+    GLuint m_mask_fbo     { 0 };
+    
+    struct ScaleBenchmark
+    {
+        u32    frames_per_scale { 0 };
+        u32    frames           { 0 };
+        double total_ms         { 0.0 };
+        double worst_ms         { 0.0 };
+        u32    best_scale       { 0 }; // highest scale holding 60 fps so far
+        
+        std::chrono::steady_clock::time_point last;
+    };
+    
+    ScaleBenchmark m_benchmark;
     
     ShaderProgram m_primitive_shader;
+    ShaderProgram m_display_shader;
+    
+    //locations are resolved once in init(), flush() and present() only set them
+    struct PrimitiveLocations
+    {
+        ShaderProgram::Uniform shape;
+        ShaderProgram::Uniform pass;
+        ShaderProgram::Uniform check_mask;
+        ShaderProgram::Uniform dither;
+        ShaderProgram::Uniform scale;
+        
+        GLint vertex[5]         { }; // in VertexAttributes order
+        GLint sprite_size       { -1 };
+        GLint line_end_position { -1 };
+        GLint line_end_color    { -1 };
+    };
+    
+    struct DisplayLocations
+    {
+        ShaderProgram::Uniform origin;
+        ShaderProgram::Uniform size;
+        ShaderProgram::Uniform factor;
+        ShaderProgram::Uniform scale;
+        ShaderProgram::Uniform depth24;
+    };
+    
+    PrimitiveLocations m_primitive_locations;
+    DisplayLocations   m_display_locations;
+    
+    static constexpr const char* m_display_shader_frag =
+    R"(
+	#version 330 core
+	
+    in vec2 position;
+    
+	out vec4 frag_color;
+    
+    uniform sampler2D vram;
+    uniform ivec2     origin; // display area in scaled VRAM texels
+    uniform ivec2     size;
+    uniform int       factor;
+    uniform int       scale;
+    uniform bool      depth24;
+    
+    //byte of the native VRAM row, put back together from the RGB5A1 texel holding it
+    uint vram_byte(int byte, int row)
+    {
+        ivec2 native = ivec2((byte >> 1) & 1023, row & 511);
+        uvec4 bits   = uvec4(round(texelFetch(vram, native * scale, 0) * vec4(31.0, 31.0, 31.0, 1.0)));
+        uint  word   = bits.r | (bits.g << 5) | (bits.b << 10) | (bits.a << 15);
+        
+        return (byte & 1) != 0 ? word >> 8 : word & 255u;
+    }
+    
+    void main()
+    {
+        //the window's first row is at the bottom, VRAM's at the top
+        vec2 uv = vec2(position.x, 1.0 - position.y);
+        
+        //24 bit mode packs 2 RGB888 pixels into 3 VRAM words, only uploads write them so native texels will do
+        if(depth24)
+        {
+            ivec2 pixels = max(size / scale, ivec2(1));
+            ivec2 pixel  = min(ivec2(uv * vec2(pixels)), pixels - 1);
+            ivec2 start  = origin / scale;
+            int   byte   = start.x * 2 + pixel.x * 3;
+            int   row    = start.y + pixel.y;
+            
+            frag_color = vec4(vram_byte(byte, row), vram_byte(byte + 1, row), vram_byte(byte + 2, row), 255.0) / 255.0;
+            return;
+        }
+        
+        //average a factor x factor box of the scaled VRAM, the window stretches the result
+        ivec2 boxes = max(size / factor, ivec2(1));
+        ivec2 base  = origin + min(ivec2(uv * vec2(boxes)), boxes - 1) * factor;
+        
+        vec3 sum = vec3(0.0);
+        
+        for(int y = 0; y < factor; y++)
+        {
+            for(int x = 0; x < factor; x++)
+            {
+                sum += texelFetch(vram, base + ivec2(x, y), 0).rgb;
+            }
+        }
+        
+        frag_color = vec4(sum / float(factor * factor), 1.0);
+    }
+    )";
+    
+    static constexpr const char* m_display_shader_vert =
+    R"(
+	#version 330 core
+	
+    out vec2 position;
+    
+    void main()
+    {
+        //a strip covering the window, made from the vertex index alone
+        position    = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+    }
+    )";
     
     static constexpr const char* m_primitive_shader_frag =
     R"(
 	#version 330 core
 	
     in vec3 color;
-	out vec4 frag_color;
+    in vec2 texcoord;
+    flat in uint  flags;
+    flat in uint  page;
+    flat in uvec4 window;
+    
+    //dual source blending, the result is frag_color + destination * blend_weight
+    layout(location = 0, index = 0) out vec4 frag_color;
+    layout(location = 0, index = 1) out vec4 blend_weight;
+    
+    uniform usampler2DArray pages;
+    uniform sampler2D       mask_snapshot; // VRAM as it was before the batch
+    uniform bool            check_mask;
+    uniform int             pass;          // 0 every fragment, 1 the opaque ones, 2 the semi transparent ones
+    uniform bool            dither;
+    uniform int             scale;
+    
+    //ordered dither added to 8 bit colour before it is truncated to 5 bits
+    const float dither_matrix[16] = float[16](-4.0,  0.0, -3.0,  1.0,
+                                               2.0, -2.0,  3.0, -1.0,
+                                              -3.0,  1.0, -4.0,  0.0,
+                                               3.0, -1.0,  2.0, -2.0);
+    
+    vec3 texture_color(inout bool semi, inout float mask)
+    {
+        uvec2 uv = uvec2(texcoord) & 255u;
+        
+        uv = (uv & ~(window.xy * 8u)) | ((window.zw & window.xy) * 8u);
+        
+        uint texel = texelFetch(pages, ivec3(uv, page), 0).r;
+        
+        //fully black texels are see-through
+        if(texel == 0u)
+        {
+            discard;
+        }
+        
+        //only texels with the top bit set are semi transparent, the bit also becomes the mask bit
+        bool stp = (texel & 0x8000u) != 0u;
+        
+        semi = semi && stp;
+        mask = stp ? 1.0 : mask;
+        
+        vec3 rgb = vec3(texel & 31u, (texel >> 5) & 31u, (texel >> 10) & 31u) / 31.0;
+        
+        //modulation treats 128 as 1.0
+        if((flags & 2u) == 0u)
+        {
+            rgb = min(rgb * color * (255.0 / 128.0), 1.0);
+        }
+        
+        return rgb;
+    }
     
     void main()
     {
-        frag_color = vec4(color, 1.0);
+        //masked pixels are never drawn over
+        if(check_mask && texelFetch(mask_snapshot, ivec2(gl_FragCoord.xy), 0).a >= 0.5)
+        {
+            discard;
+        }
+        
+        vec3  rgb  = color;
+        bool  semi = (flags & 16u) != 0u;
+        float mask = (flags & 128u) != 0u ? 1.0 : 0.0;
+        
+        if((flags & 1u) != 0u)
+        {
+            rgb = texture_color(semi, mask);
+        }
+        
+        if(pass != 0 && semi != (pass == 2))
+        {
+            discard;
+        }
+        
+        //the pattern follows native VRAM pixels at any scale
+        if(dither)
+        {
+            ivec2 pixel = ivec2(gl_FragCoord.xy) / scale;
+            float shift = dither_matrix[(pixel.y & 3) * 4 + (pixel.x & 3)];
+            
+            rgb = floor(clamp(floor(rgb * 255.0 + 0.5) + shift, 0.0, 255.0) / 8.0) / 31.0;
+        }
+        
+        //source and destination weights, subtraction is left to the blend equation
+        vec2 weights = vec2(1.0, 0.0);
+        
+        if(semi)
+        {
+            uint mode = (flags >> 5) & 3u;
+            
+            weights = mode == 0u ? vec2(0.5, 0.5) : mode == 3u ? vec2(0.25, 1.0) : vec2(1.0, 1.0);
+        }
+        
+        //alpha ends up in the mask bit
+        frag_color   = vec4(rgb * weights.x, mask);
+        blend_weight = vec4(vec3(weights.y), 0.0);
     }
     )";
     
@@ -109,22 +614,66 @@ private:
 	#version 330 core
 	
     in ivec2 vertex_position;
-    in uvec3 vertex_color;
+    in uvec4 vertex_color; // r, g, b, flags
+    in uvec2 vertex_texcoord;
+    in uint  vertex_page;
+    in uvec4 vertex_window;
+    
+    in uvec2 sprite_size;       // sprites only
+    in ivec2 line_end_position; // lines only
+    in uvec4 line_end_color;
     
     out vec3 color;
+    out vec2 texcoord;
+    flat out uint  flags;
+    flat out uint  page;
+    flat out uvec4 window;
 	
-	uniform ivec2 offset;
+    uniform int shape; // 0 triangles, 1 sprite instances, 2 line instances
     
     void main()
     {
-		ivec2 position = vertex_position + offset;
-		
-        float xpos = (float(position.x) / 512.0) - 1.0;
-        float ypos = 1.0 - (float(position.y) / 256.0);
+        vec2 position = vec2(vertex_position);
+        
+        color    = vec3(vertex_color.rgb) / 255.0;
+        flags    = vertex_color.a;
+        texcoord = vec2(vertex_texcoord);
+        page     = vertex_page;
+        window   = vertex_window;
         
-        gl_Position = vec4(xpos, ypos, 0.0, 1.0);
+        //instances are 4 vertex strips, the vertex index picks the corner
+        vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        
+        if(shape == 1)
+        {
+            //one texel per pixel, flipped axes count down from the origin texel
+            vec2 size = vec2(sprite_size) * corner;
+            vec2 flip = vec2((flags & 4u) != 0u, (flags & 8u) != 0u);
+            
+            position += size;
+            texcoord += 1024.0 + mix(size, 1.0 - size, flip);
+        }
+        else if(shape == 2)
+        {
+            vec2 end   = vec2(line_end_position);
+            vec2 delta = end - position;
+            
+            //one pixel across the major axis, reaching half a pixel past both end pixels
+            bool x_major = abs(delta.x) >= abs(delta.y);
+            vec2 major   = x_major ? vec2(delta.x < 0.0 ? -0.5 : 0.5, 0.0) : vec2(0.0, delta.y < 0.0 ? -0.5 : 0.5);
+            vec2 minor   = x_major ? vec2(0.0, 0.5) : vec2(0.5, 0.0);
+            
+            position  = corner.y == 0.0 ? position - major : end + major;
+            position += 0.5 + (corner.x == 0.0 ? -minor : minor);
+            
+            if(corner.y != 0.0)
+            {
+                color = vec3(line_end_color.rgb) / 255.0;
+            }
+        }
         
-        color = vec3(vertex_color) / 255.0;
+        //VRAM row 0 is the first row of the VRAM texture, the viewport takes care of the scale
+        gl_Position = vec4(position.x / 512.0 - 1.0, position.y / 256.0 - 1.0, 0.0, 1.0);
     }
     )";
 };
@@ -0,0 +1,61 @@
+#include "Scheduler.hpp"
+
+void Scheduler::schedule(Event event, u64 delay)
+{
+    Slot& s = slot(event);
+    
+    s.when    = m_now + delay;
+    s.pending = true;
+    
+    update_next();
+}
+
+void Scheduler::cancel(Event event)
+{
+    slot(event).pending = false;
+    
+    update_next();
+}
+
+void Scheduler::run_due()
+{
+    //handlers may reschedule themselves or others, so pick the earliest due event each round
+    for(;;)
+    {
+        Slot* due = nullptr;
+        
+        for(Slot& s : m_slots)
+        {
+            if(s.pending && s.when <= m_now && (due == nullptr || s.when < due->when))
+            {
+                due = &s;
+            }
+        }
+        
+        if(due == nullptr)
+        {
+            break;
+        }
+        
+        due->pending = false;
+        update_next();
+        
+        assert(due->handler);
+        due->handler();
+    }
+    
+    update_next();
+}
+
+void Scheduler::update_next()
+{
+    m_next = ~u64(0);
+    
+    for(const Slot& s : m_slots)
+    {
+        if(s.pending && s.when < m_next)
+        {
+            m_next = s.when;
+        }
+    }
+}
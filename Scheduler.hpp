@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <functional>
+
+/**
+ * cycle counter driving timed device events
+ *
+ * every device owns one event slot, rescheduling an event replaces its previous deadline
+ */
+class Scheduler
+{
+public:
+    
+    /**
+     * system clock in cycles per second
+     */
+    static constexpr const u32 ClockRate = 33868800;
+    
+    enum class Event : u8
+    {
+        DMA,
+        VBlank,
+        Count
+    };
+    
+    using Handler = std::function<void()>;
+    
+    Scheduler() {}
+    
+    void set_handler(Event event, Handler handler) { slot(event).handler = std::move(handler); }
+    
+    /**
+     * fire event after delay cycles
+     */
+    void schedule(Event event, u64 delay);
+    void cancel(Event event);
+    bool pending(Event event) { return slot(event).pending; }
+    
+    u64 now()  const { return m_now; }
+    u64 next() const { return m_next; }
+    
+    /**
+     * advance the clock, firing every event which became due
+     */
+    void tick(u32 cycles)
+    {
+        m_now += cycles;
+        
+        if(m_now >= m_next)
+        {
+            run_due();
+        }
+    }
+    
+    void advance_to(u64 cycle)
+    {
+        if(cycle > m_now)
+        {
+            m_now = cycle;
+        }
+        
+        if(m_now >= m_next)
+        {
+            run_due();
+        }
+    }
+    
+    void skip_to_next_event()
+    {
+        if(m_next != ~u64(0))
+        {
+            advance_to(m_next);
+        }
+    }
+    
+private:
+    
+    struct Slot
+    {
+        u64     when    { 0 };
+        bool    pending { false };
+        Handler handler;
+    };
+    
+    Slot& slot(Event event) { return m_slots[static_cast<u8>(event)]; }
+    
+    void run_due();
+    void update_next();
+    
+    Slot m_slots[static_cast<u8>(Event::Count)];
+    
+    u64 m_now  { 0 };
+    u64 m_next { ~u64(0) };
+};
@@ -1,31 +1,203 @@
 #include "ShaderProgram.hpp"
+#include "File.hpp"
 
+#include <cstdio>
+#include <cstring>
+
+std::string ShaderProgram::m_cache_directory;
 
 //destructor
 ShaderProgram::~ShaderProgram()
 {
-    glDetachShader(m_program, m_vertex_shader);
-    glDetachShader(m_program, m_fragment_shader);
+    //programs loaded from a binary never had shaders attached
+    if(m_vertex_shader != 0)
+    {
+        glDetachShader(m_program, m_vertex_shader);
+        glDetachShader(m_program, m_fragment_shader);
+    }
+    
     glDeleteShader(m_vertex_shader);
     glDeleteShader(m_fragment_shader);
     glDeleteProgram(m_program);
 }
 
+void ShaderProgram::set_cache_directory(const char* path)
+{
+    m_cache_directory = path != nullptr ? path : "";
+}
+
 void ShaderProgram::init(const char* vertex_source, const char* fragment_source)
 {
+    //create program
+    m_program = glCreateProgram();
+    
+    std::string cache_path = binary_path(vertex_source, fragment_source);
+    
+    if(!cache_path.empty() && load_binary(cache_path))
+    {
+        return;
+    }
+    
     //compile vertex shader
     m_vertex_shader = compile(vertex_source, GL_VERTEX_SHADER);
     //compile vertex shader
     m_fragment_shader = compile(fragment_source, GL_FRAGMENT_SHADER);
     
-    //create program
-    m_program = glCreateProgram();
-    
     //link shaders
     glAttachShader(m_program, m_vertex_shader);
     glAttachShader(m_program, m_fragment_shader);
     
+#if defined GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+    if(!cache_path.empty())
+    {
+        glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+#endif
+    
     glLinkProgram(m_program);
+    
+    if(!linked())
+    {
+        return;
+    }
+    
+    if(!cache_path.empty())
+    {
+        save_binary(cache_path);
+    }
+}
+
+//FNV-1a, the separator keeps "ab" + "c" apart from "a" + "bc"
+static u64 hash_text(u64 hash, const char* text)
+{
+    for(const char* c = text != nullptr ? text : ""; ; c++)
+    {
+        hash ^= static_cast<u8>(*c);
+        hash *= 0x100000001B3ull;
+        
+        if(*c == 0)
+        {
+            return hash;
+        }
+    }
+}
+
+std::string ShaderProgram::binary_path(const char* vertex_source, const char* fragment_source)
+{
+#if defined GL_NUM_PROGRAM_BINARY_FORMATS
+    if(m_cache_directory.empty())
+    {
+        return "";
+    }
+    
+    //no formats means the driver can't hand binaries back
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    
+    if(formats == 0)
+    {
+        return "";
+    }
+    
+    //a binary is only good for the driver that built it
+    u64 hash = 0xCBF29CE484222325ull;
+    hash = hash_text(hash, vertex_source);
+    hash = hash_text(hash, fragment_source);
+    hash = hash_text(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+    hash = hash_text(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    hash = hash_text(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(hash));
+    
+    return m_cache_directory + name;
+#else
+    return "";
+#endif
+}
+
+//cache files are the binary format as a little endian u32 followed by the binary
+bool ShaderProgram::load_binary(const std::string& path)
+{
+#if defined GL_NUM_PROGRAM_BINARY_FORMATS
+    File file(path);
+    
+    if(!file.is_file())
+    {
+        return false;
+    }
+    
+    std::vector<u8> data = file.read();
+    
+    if(data.size() <= 4)
+    {
+        return false;
+    }
+    
+    GLenum format = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+    
+    glProgramBinary(m_program, format, data.data() + 4, static_cast<GLsizei>(data.size() - 4));
+    
+    GLint status = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &status);
+    
+    if(status != GL_TRUE)
+    {
+        std::printf("ShaderProgram::load_binary() log: %s was rejected, recompiling\n", path.c_str());
+        return false;
+    }
+    
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ShaderProgram::save_binary(const std::string& path)
+{
+#if defined GL_NUM_PROGRAM_BINARY_FORMATS
+    GLint length = 0;
+    glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    
+    if(length <= 0)
+    {
+        return;
+    }
+    
+    std::vector<u8> data(length + 4);
+    
+    GLenum format = 0;
+    glGetProgramBinary(m_program, length, &length, &format, data.data() + 4);
+    data.resize(length + 4);
+    
+    for(u32 i = 0; i < 4; i++)
+    {
+        data[i] = static_cast<u8>(format >> (i * 8));
+    }
+    
+    File file(path, File::OpenMode::Write);
+    
+    if(!file.is_file() || file.write(data) != data.size())
+    {
+        std::printf("ShaderProgram::save_binary() warning: can't write %s\n", path.c_str());
+    }
+#endif
+}
+
+bool ShaderProgram::linked()
+{
+    GLint status = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &status);
+    
+    if(status != GL_TRUE)
+    {
+        char error[256] = { 0 };
+        glGetProgramInfoLog(m_program, sizeof(error), NULL, error);
+        
+        std::printf("ShaderProgram::init() error: link error: %s\n", error);
+    }
+    
+    return status == GL_TRUE;
 }
 
 //compile GLSL shader source
@@ -59,29 +231,29 @@ u32 ShaderProgram::compile(const char* source, u32 mode)
 
 //setting uniform variables in shader program
 void ShaderProgram::set1i(int value, const char* uniform_name) {
-    glUniform1i(glGetUniformLocation(m_program, uniform_name), value);
+    set1i(value, uniform(uniform_name));
 }
 void ShaderProgram::set1f(float value, const char* uniform_name) {
-    glUniform1f(glGetUniformLocation(m_program, uniform_name), value);
+    set1f(value, uniform(uniform_name));
 }
 void ShaderProgram::set2f(glm::vec2 value, const char* uniform_name) {
-    glUniform2f(glGetUniformLocation(m_program, uniform_name), value.x, value.y);
+    set2f(value, uniform(uniform_name));
 }
 void ShaderProgram::set2i(glm::ivec2 value, const char* uniform_name)
 {
-	glUniform2i(glGetUniformLocation(m_program, uniform_name), value.x, value.y);
+	set2i(value, uniform(uniform_name));
 }
 void ShaderProgram::set3f(glm::vec3 value, const char* uniform_name) {
-    glUniform3f(glGetUniformLocation(m_program, uniform_name), value.x, value.y, value.z);
+    set3f(value, uniform(uniform_name));
 }
 void ShaderProgram::set4f(glm::vec4 value, const char* uniform_name) {
-    glUniform4f(glGetUniformLocation(m_program, uniform_name), value.x, value.y, value.z, value.w);
+    set4f(value, uniform(uniform_name));
 }
 void ShaderProgram::set1b(bool value, const char* uniform_name) {
-    glUniform1i(glGetUniformLocation(m_program, uniform_name), value);
+    set1b(value, uniform(uniform_name));
 }
 void ShaderProgram::set4x4m(glm::mat4 value, const char* uniform_name) {
-    glUniformMatrix4fv(glGetUniformLocation(m_program, uniform_name), 1, false, &value[0][0]);
+    set4x4m(value, uniform(uniform_name));
 }
 void ShaderProgram::set1fv(float* array, u32 size, const char* uniform_name) {
     glUniform1fv(glGetUniformLocation(m_program, uniform_name), size, array);
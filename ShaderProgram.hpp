@@ -21,11 +21,21 @@
 
 /**
  * \brief compile and use glsl program
+ *
+ * linked programs can be cached as driver binaries, see set_cache_directory()
  */
 class ShaderProgram
 {
 public:
     
+    /**
+     * \brief uniform location resolved once by uniform()
+     */
+    struct Uniform
+    {
+        GLint location { -1 };
+    };
+    
     /**
      * \brief constructor/destructor
      */
@@ -39,13 +49,38 @@ public:
     void unuse() { glUseProgram(0);         }
     
     /**
-     * \brief compile glsl program
+     * \brief compile glsl program, or load it from the binary cache
      */
     void init(const char* vertex_source, const char* fragment_source);
     u32 compile(const char* source, u32 mode);
     
     /**
-     * \brief set uniform
+     * \brief directory the program binaries are kept in, null disables the cache
+     *
+     * binaries are keyed by a hash of the sources and the driver strings,
+     * a driver that rejects its old binary gets the program recompiled
+     */
+    static void set_cache_directory(const char* path);
+    
+    /**
+     * \brief resolve a uniform location for the handle setters
+     */
+    Uniform uniform(const char* uniform_name) const { return { glGetUniformLocation(m_program, uniform_name) }; }
+    
+    /**
+     * \brief set uniform by handle
+     */
+    void set1i(int         value, Uniform uniform) { glUniform1i(uniform.location, value);                                }
+    void set1f(float       value, Uniform uniform) { glUniform1f(uniform.location, value);                                }
+    void set2f(glm::vec2   value, Uniform uniform) { glUniform2f(uniform.location, value.x, value.y);                     }
+    void set2i(glm::ivec2  value, Uniform uniform) { glUniform2i(uniform.location, value.x, value.y);                     }
+    void set3f(glm::vec3   value, Uniform uniform) { glUniform3f(uniform.location, value.x, value.y, value.z);            }
+    void set4f(glm::vec4   value, Uniform uniform) { glUniform4f(uniform.location, value.x, value.y, value.z, value.w);   }
+    void set1b(bool        value, Uniform uniform) { glUniform1i(uniform.location, value);                                }
+    void set4x4m(glm::mat4 value, Uniform uniform) { glUniformMatrix4fv(uniform.location, 1, false, &value[0][0]);        }
+    
+    /**
+     * \brief set uniform by name, looked up on every call
      */
     void set1i(int         value, const char* uniform_name);
     void set1f(float       value, const char* uniform_name);
@@ -68,7 +103,19 @@ public:
 	GLuint get_attribute_index(const char* attribute_name);
     
 private:
-    u32 m_vertex_shader, m_fragment_shader, m_program;
+    
+    //cache file for these sources on this driver, empty when the cache is off or unsupported
+    static std::string binary_path(const char* vertex_source, const char* fragment_source);
+    
+    bool load_binary(const std::string& path);
+    void save_binary(const std::string& path);
+    bool linked();
+    
+    static std::string m_cache_directory;
+    
+    u32 m_vertex_shader   { 0 };
+    u32 m_fragment_shader { 0 };
+    u32 m_program         { 0 };
     
 };
 
@@ -0,0 +1,938 @@
+#include "SoftwareRenderer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#if defined __i386__ || defined __x86_64__
+#include <immintrin.h>
+#define SOFTWARE_RENDERER_X86
+#endif
+
+//ordered dither added to 8 bit colour before it is truncated to 5 bits
+static constexpr const s8 DitherMatrix[4][4] =
+{
+    { -4,  0, -3,  1 },
+    {  2, -2,  3, -1 },
+    { -3,  1, -4,  0 },
+    {  3, -1,  2, -2 }
+};
+
+static inline s32 clamp_color(s32 c)
+{
+    return std::clamp(c, 0, 255);
+}
+
+static inline s64 floor_div(s64 a, s64 b)
+{
+    s64 q = a / b;
+
+    if((a % b != 0) && ((a < 0) != (b < 0)))
+    {
+        q--;
+    }
+
+    return q;
+}
+
+static inline s64 ceil_div(s64 a, s64 b)
+{
+    return -floor_div(-a, b);
+}
+
+SoftwareRenderer::SoftwareRenderer(u16* vram) : m_vram(vram), m_gouraud_span(gouraud_span_scalar)
+{
+    set_span_path(SpanPath::Auto);
+}
+
+void SoftwareRenderer::draw_quad(const Vertex (&vertices)[4], u8 flags, const State& state)
+{
+    //the gpu splits quads along the 1-2 diagonal
+    const Vertex first[3]  = { vertices[0], vertices[1], vertices[2] };
+    const Vertex second[3] = { vertices[1], vertices[2], vertices[3] };
+
+    draw_triangle(first, flags, state);
+    draw_triangle(second, flags, state);
+}
+
+void SoftwareRenderer::draw_triangle(const Vertex (&vertices)[3], u8 flags, const State& state)
+{
+    if(m_pool.workers() == 0)
+    {
+        rasterize_triangle(vertices, flags, state);
+        return;
+    }
+
+    Primitive primitive;
+
+    primitive.vertices[0] = vertices[0];
+    primitive.vertices[1] = vertices[1];
+    primitive.vertices[2] = vertices[2];
+    primitive.flags       = flags;
+    primitive.shape       = Shape::Triangle;
+    primitive.state       = state;
+
+    primitive.bounds.left   = std::min({ vertices[0].x, vertices[1].x, vertices[2].x });
+    primitive.bounds.right  = std::max({ vertices[0].x, vertices[1].x, vertices[2].x });
+    primitive.bounds.top    = std::min({ vertices[0].y, vertices[1].y, vertices[2].y });
+    primitive.bounds.bottom = std::max({ vertices[0].y, vertices[1].y, vertices[2].y });
+
+    queue(primitive);
+}
+
+void SoftwareRenderer::draw_rectangle(const Vertex& origin, s32 width, s32 height, u8 flags, const State& state)
+{
+    if(m_pool.workers() == 0)
+    {
+        rasterize_rectangle(origin, width, height, flags, state);
+        return;
+    }
+
+    Primitive primitive;
+
+    primitive.vertices[0]   = origin;
+    primitive.vertices[1].x = width;
+    primitive.vertices[1].y = height;
+    primitive.flags         = flags;
+    primitive.shape         = Shape::Rectangle;
+    primitive.state         = state;
+
+    primitive.bounds = { origin.x, origin.y, origin.x + width - 1, origin.y + height - 1 };
+
+    queue(primitive);
+}
+
+void SoftwareRenderer::draw_line(const Vertex (&vertices)[2], u8 flags, const State& state)
+{
+    if(m_pool.workers() == 0)
+    {
+        rasterize_line(vertices, flags, state);
+        return;
+    }
+
+    Primitive primitive;
+
+    primitive.vertices[0] = vertices[0];
+    primitive.vertices[1] = vertices[1];
+    primitive.flags       = flags & ~Textured;
+    primitive.shape       = Shape::Line;
+    primitive.state       = state;
+
+    primitive.bounds.left   = std::min(vertices[0].x, vertices[1].x);
+    primitive.bounds.right  = std::max(vertices[0].x, vertices[1].x);
+    primitive.bounds.top    = std::min(vertices[0].y, vertices[1].y);
+    primitive.bounds.bottom = std::max(vertices[0].y, vertices[1].y);
+
+    queue(primitive);
+}
+
+void SoftwareRenderer::queue(const Primitive& primitive)
+{
+    const State& state = primitive.state;
+
+    Rect bounds = primitive.bounds;
+
+    bounds.left   = std::max({ bounds.left,   state.clip_left,   0 });
+    bounds.right  = std::min({ bounds.right,  state.clip_right,  s32(VRAMWidth - 1) });
+    bounds.top    = std::max({ bounds.top,    state.clip_top,    0 });
+    bounds.bottom = std::min({ bounds.bottom, state.clip_bottom, s32(VRAMHeight - 1) });
+
+    if(bounds.empty())
+    {
+        return;
+    }
+
+    //tiles run out of order relative to each other, so a primitive must not sample
+    //what a queued one draws nor draw over what a queued one samples
+    Rect sampled;
+
+    if(primitive.flags & Textured)
+    {
+        //texture lookups wrap around the right edge of VRAM, take the whole width when they do
+        auto wrap = [](Rect rect)
+        {
+            if(rect.right >= s32(VRAMWidth))
+            {
+                rect.left  = 0;
+                rect.right = VRAMWidth - 1;
+            }
+
+            return rect;
+        };
+
+        sampled = wrap({ state.texpage_x, state.texpage_y, state.texpage_x + 255, state.texpage_y + 255 });
+
+        if(state.tex_depth < 2)
+        {
+            sampled.merge(wrap({ state.clut_x, state.clut_y, state.clut_x + 255, state.clut_y }));
+        }
+
+        if(sampled.overlaps(m_batch_written))
+        {
+            flush();
+        }
+
+        //a primitive reading back its own output depends on raster order, keep it in scanline order
+        if(sampled.overlaps(bounds))
+        {
+            flush();
+            rasterize(primitive, state);
+            return;
+        }
+    }
+
+    if(bounds.overlaps(m_batch_sampled))
+    {
+        flush();
+    }
+
+    m_batch.push_back(primitive);
+    m_batch.back().bounds = bounds;
+    m_batch_written.merge(bounds);
+
+    if(!sampled.empty())
+    {
+        m_batch_sampled.merge(sampled);
+    }
+
+    if(m_batch.size() >= MaxBatch)
+    {
+        flush();
+    }
+}
+
+void SoftwareRenderer::rasterize(const Primitive& primitive, const State& state)
+{
+    switch(primitive.shape)
+    {
+        case Shape::Triangle:
+        {
+            rasterize_triangle(primitive.vertices, primitive.flags, state);
+            break;
+        }
+        case Shape::Rectangle:
+        {
+            rasterize_rectangle(primitive.vertices[0], primitive.vertices[1].x, primitive.vertices[1].y, primitive.flags, state);
+            break;
+        }
+        case Shape::Line:
+        {
+            const Vertex line[2] = { primitive.vertices[0], primitive.vertices[1] };
+
+            rasterize_line(line, primitive.flags, state);
+            break;
+        }
+    }
+}
+
+void SoftwareRenderer::set_threads(u32 threads)
+{
+    flush();
+
+    //the calling thread rasterizes too, so it only needs threads - 1 helpers
+    m_pool.start(threads > 1 ? threads - 1 : 0);
+}
+
+void SoftwareRenderer::set_span_path(SpanPath path)
+{
+    flush();
+
+    bool avx2  = false;
+    bool sse41 = false;
+
+#if defined SOFTWARE_RENDERER_X86
+    __builtin_cpu_init();
+
+    avx2  = __builtin_cpu_supports("avx2");
+    sse41 = __builtin_cpu_supports("sse4.1");
+#endif
+
+    m_gouraud_span = gouraud_span_scalar;
+
+    if(avx2 && (path == SpanPath::Auto || path == SpanPath::AVX2))
+    {
+        m_gouraud_span = gouraud_span_avx2;
+    }
+    else if(sse41 && (path == SpanPath::Auto || path == SpanPath::SSE41))
+    {
+        m_gouraud_span = gouraud_span_sse41;
+    }
+}
+
+void SoftwareRenderer::flush()
+{
+    if(m_batch.empty())
+    {
+        return;
+    }
+
+    for(std::vector<u32>& tile : m_tiles)
+    {
+        tile.clear();
+    }
+
+    m_busy_tiles.clear();
+
+    //bin in submission order so every tile replays its primitives in the order the gpu got them
+    for(u32 i = 0; i < m_batch.size(); i++)
+    {
+        const Rect& bounds = m_batch[i].bounds;
+
+        for(u32 ty = bounds.top / TileSize; ty <= bounds.bottom / TileSize; ty++)
+        {
+            for(u32 tx = bounds.left / TileSize; tx <= bounds.right / TileSize; tx++)
+            {
+                u32 tile = ty * TilesX + tx;
+
+                if(m_tiles[tile].empty())
+                {
+                    m_busy_tiles.push_back(tile);
+                }
+
+                m_tiles[tile].push_back(i);
+            }
+        }
+    }
+
+    m_pool.run(m_busy_tiles.size(), [this](u32 job)
+    {
+        u32 tile = m_busy_tiles[job];
+
+        s32 left   = (tile % TilesX) * TileSize;
+        s32 top    = (tile / TilesX) * TileSize;
+        s32 right  = left + TileSize - 1;
+        s32 bottom = top  + TileSize - 1;
+
+        //tiles never share pixels, so each one can run on its own thread
+        for(u32 index : m_tiles[tile])
+        {
+            const Primitive& primitive = m_batch[index];
+
+            State state = primitive.state;
+
+            state.clip_left   = std::max(state.clip_left,   left);
+            state.clip_top    = std::max(state.clip_top,    top);
+            state.clip_right  = std::min(state.clip_right,  right);
+            state.clip_bottom = std::min(state.clip_bottom, bottom);
+
+            rasterize(primitive, state);
+        }
+    });
+
+    m_batch.clear();
+    m_batch_written = Rect();
+    m_batch_sampled = Rect();
+}
+
+void SoftwareRenderer::rasterize_triangle(const Vertex (&vertices)[3], u8 flags, const State& state)
+{
+    const Vertex* v0 = &vertices[0];
+    const Vertex* v1 = &vertices[1];
+    const Vertex* v2 = &vertices[2];
+
+    s64 area = s64(v1->x - v0->x) * (v2->y - v0->y) - s64(v2->x - v0->x) * (v1->y - v0->y);
+
+    if(area == 0)
+    {
+        return;
+    }
+
+    //keep a consistent winding so that inside is always the positive side of every edge
+    if(area < 0)
+    {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    s32 min_x = std::min({ v0->x, v1->x, v2->x });
+    s32 max_x = std::max({ v0->x, v1->x, v2->x });
+    s32 min_y = std::min({ v0->y, v1->y, v2->y });
+    s32 max_y = std::max({ v0->y, v1->y, v2->y });
+
+    //the gpu skips primitives which are too large
+    if(max_x - min_x >= 1024 || max_y - min_y >= 512)
+    {
+        return;
+    }
+
+    min_x = std::max(min_x, state.clip_left);
+    max_x = std::min(max_x, state.clip_right);
+    min_y = std::max(min_y, state.clip_top);
+    max_y = std::min(max_y, state.clip_bottom);
+
+    if(min_x > max_x || min_y > max_y)
+    {
+        return;
+    }
+
+    //edge functions e(x, y) = a * x + b * y + c, pixels on an edge belong to it only if it is a top or left edge
+    struct Edge
+    {
+        s64 a, b, c;
+        s64 bias;
+    } edges[3];
+
+    auto setup_edge = [](Edge& edge, const Vertex* from, const Vertex* to)
+    {
+        edge.a    = -(to->y - from->y);
+        edge.b    = to->x - from->x;
+        edge.c    = -(edge.a * from->x + edge.b * from->y);
+        edge.bias = (edge.a > 0 || (edge.a == 0 && edge.b > 0)) ? 0 : 1;
+    };
+
+    setup_edge(edges[0], v1, v2);
+    setup_edge(edges[1], v2, v0);
+    setup_edge(edges[2], v0, v1);
+
+    auto setup_gradient = [&](s32 a0, s32 a1, s32 a2)
+    {
+        Gradient gradient;
+
+        gradient.dx   = static_cast<s32>(((s64(a1 - a0) * (v2->y - v0->y) - s64(a2 - a0) * (v1->y - v0->y)) << GradientShift) / area);
+        gradient.dy   = static_cast<s32>(((s64(a2 - a0) * (v1->x - v0->x) - s64(a1 - a0) * (v2->x - v0->x)) << GradientShift) / area);
+        gradient.base = (s64(a0) << GradientShift) + (1 << (GradientShift - 1)) - s64(gradient.dx) * v0->x - s64(gradient.dy) * v0->y;
+
+        return gradient;
+    };
+
+    bool gouraud  = flags & Gouraud;
+    bool textured = flags & Textured;
+    bool raw      = flags & RawTexture;
+    bool semi     = flags & SemiTransparent;
+
+    Gradient r, g, b, u, v;
+
+    if(gouraud)
+    {
+        r = setup_gradient(v0->r, v1->r, v2->r);
+        g = setup_gradient(v0->g, v1->g, v2->g);
+        b = setup_gradient(v0->b, v1->b, v2->b);
+    }
+
+    if(textured)
+    {
+        u = setup_gradient(v0->u, v1->u, v2->u);
+        v = setup_gradient(v0->v, v1->v, v2->v);
+    }
+
+    bool dithering = state.dithering && (gouraud || (textured && !raw));
+    u16  mask_bit  = state.force_mask ? 0x8000 : 0;
+
+    //untextured opaque primitives are plain span fills
+    bool fast_path = !textured && !semi && !state.check_mask;
+
+    u16 flat_color = (v0->r >> 3) | ((v0->g >> 3) << 5) | ((v0->b >> 3) << 10) | mask_bit;
+
+    for(s32 y = min_y; y <= max_y; y++)
+    {
+        s64 x_start = min_x;
+        s64 x_end   = max_x;
+
+        //clip the row against every edge, e(min_x + k, y) >= bias
+        for(const Edge& edge : edges)
+        {
+            s64 e = edge.a * min_x + edge.b * y + edge.c - edge.bias;
+
+            if(edge.a == 0)
+            {
+                if(e < 0)
+                {
+                    x_end = x_start - 1;
+                }
+            }
+            else if(edge.a > 0)
+            {
+                if(e < 0)
+                {
+                    x_start = std::max(x_start, min_x + ceil_div(-e, edge.a));
+                }
+            }
+            else
+            {
+                x_end = std::min(x_end, min_x + floor_div(e, -edge.a));
+            }
+        }
+
+        if(x_start > x_end)
+        {
+            continue;
+        }
+
+        s32  xs    = static_cast<s32>(x_start);
+        u32  count = static_cast<u32>(x_end - x_start + 1);
+        u16* dst   = row(y) + xs;
+
+        s8 dither[4];
+
+        for(u32 i = 0; i < 4; i++)
+        {
+            dither[i] = DitherMatrix[y & 3][(xs + i) & 3];
+        }
+
+        if(fast_path)
+        {
+            if(gouraud)
+            {
+                Span span = { r.at(xs, y), g.at(xs, y), b.at(xs, y), r.dx, g.dx, b.dx };
+
+                m_gouraud_span(dst, count, span, dithering ? dither : nullptr, mask_bit);
+            }
+            else
+            {
+                std::fill_n(dst, count, flat_color);
+            }
+
+            continue;
+        }
+
+        s32 cr = gouraud  ? r.at(xs, y) : 0;
+        s32 cg = gouraud  ? g.at(xs, y) : 0;
+        s32 cb = gouraud  ? b.at(xs, y) : 0;
+        s32 cu = textured ? u.at(xs, y) : 0;
+        s32 cv = textured ? v.at(xs, y) : 0;
+
+        for(u32 i = 0; i < count; i++, cr += r.dx, cg += g.dx, cb += b.dx, cu += u.dx, cv += v.dx)
+        {
+            if(state.check_mask && (dst[i] & 0x8000))
+            {
+                continue;
+            }
+
+            s32 pr = gouraud ? clamp_color(cr >> GradientShift) : v0->r;
+            s32 pg = gouraud ? clamp_color(cg >> GradientShift) : v0->g;
+            s32 pb = gouraud ? clamp_color(cb >> GradientShift) : v0->b;
+
+            u16  color;
+            u16  texel_mask  = 0;
+            bool transparent = semi;
+
+            if(textured)
+            {
+                u16 t = texel(state, clamp_color(cu >> GradientShift), clamp_color(cv >> GradientShift));
+
+                //fully black texels are see-through
+                if(t == 0)
+                {
+                    continue;
+                }
+
+                texel_mask  = t & 0x8000;
+                transparent = semi && texel_mask;
+
+                if(raw)
+                {
+                    color = t & 0x7FFF;
+                }
+                else
+                {
+                    //texel * colour / 128, kept in 8 bits for the dither
+                    pr = std::min(((t >>  0) & 0x1F) * pr >> 4, 255);
+                    pg = std::min(((t >>  5) & 0x1F) * pg >> 4, 255);
+                    pb = std::min(((t >> 10) & 0x1F) * pb >> 4, 255);
+                }
+            }
+
+            if(!textured || !raw)
+            {
+                if(dithering)
+                {
+                    s8 d = dither[i & 3];
+
+                    pr = clamp_color(pr + d);
+                    pg = clamp_color(pg + d);
+                    pb = clamp_color(pb + d);
+                }
+
+                color = (pr >> 3) | ((pg >> 3) << 5) | ((pb >> 3) << 10);
+            }
+
+            if(transparent)
+            {
+                color = blend(dst[i], color, state.semi_transparency);
+            }
+
+            dst[i] = color | texel_mask | mask_bit;
+        }
+    }
+}
+
+void SoftwareRenderer::rasterize_rectangle(const Vertex& origin, s32 width, s32 height, u8 flags, const State& state)
+{
+    s32 left   = std::max(origin.x, state.clip_left);
+    s32 top    = std::max(origin.y, state.clip_top);
+    s32 right  = std::min(origin.x + width  - 1, state.clip_right);
+    s32 bottom = std::min(origin.y + height - 1, state.clip_bottom);
+
+    if(left > right || top > bottom)
+    {
+        return;
+    }
+
+    bool textured = flags & Textured;
+    bool raw      = flags & RawTexture;
+    bool semi     = flags & SemiTransparent;
+
+    //texcoords step one texel per pixel, flipped rectangles count down from the origin
+    s32 du = (flags & FlipX) ? -1 : 1;
+    s32 dv = (flags & FlipY) ? -1 : 1;
+
+    u16 mask_bit   = state.force_mask ? 0x8000 : 0;
+    u16 flat_color = (origin.r >> 3) | ((origin.g >> 3) << 5) | ((origin.b >> 3) << 10);
+
+    //rectangles are never dithered
+    for(s32 y = top; y <= bottom; y++)
+    {
+        u16* dst = row(y);
+
+        if(!textured && !semi && !state.check_mask)
+        {
+            std::fill(dst + left, dst + right + 1, flat_color | mask_bit);
+            continue;
+        }
+
+        u8 v = static_cast<u8>(origin.v + (y - origin.y) * dv);
+
+        for(s32 x = left; x <= right; x++)
+        {
+            if(state.check_mask && (dst[x] & 0x8000))
+            {
+                continue;
+            }
+
+            u16  color       = flat_color;
+            u16  texel_mask  = 0;
+            bool transparent = semi;
+
+            if(textured)
+            {
+                u16 t = texel(state, static_cast<u8>(origin.u + (x - origin.x) * du), v);
+
+                //fully black texels are see-through
+                if(t == 0)
+                {
+                    continue;
+                }
+
+                texel_mask  = t & 0x8000;
+                transparent = semi && texel_mask;
+
+                if(raw)
+                {
+                    color = t & 0x7FFF;
+                }
+                else
+                {
+                    //texel * colour / 128
+                    s32 pr = std::min(((t >>  0) & 0x1F) * origin.r >> 4, 255);
+                    s32 pg = std::min(((t >>  5) & 0x1F) * origin.g >> 4, 255);
+                    s32 pb = std::min(((t >> 10) & 0x1F) * origin.b >> 4, 255);
+
+                    color = (pr >> 3) | ((pg >> 3) << 5) | ((pb >> 3) << 10);
+                }
+            }
+
+            if(transparent)
+            {
+                color = blend(dst[x], color, state.semi_transparency);
+            }
+
+            dst[x] = color | texel_mask | mask_bit;
+        }
+    }
+}
+
+void SoftwareRenderer::rasterize_line(const Vertex (&vertices)[2], u8 flags, const State& state)
+{
+    const Vertex& from = vertices[0];
+    const Vertex& to   = vertices[1];
+
+    s32 dx = to.x - from.x;
+    s32 dy = to.y - from.y;
+
+    //the gpu skips lines which are too long
+    if(std::abs(dx) >= 1024 || std::abs(dy) >= 512)
+    {
+        return;
+    }
+
+    bool gouraud   = flags & Gouraud;
+    bool semi      = flags & SemiTransparent;
+    bool dithering = state.dithering && gouraud;
+
+    s32 steps = std::max(std::abs(dx), std::abs(dy));
+
+    //positions and colours step in 16.16 fixed point, positions rounded to the nearest pixel
+    auto step = [steps](s32 delta) { return steps == 0 ? 0 : static_cast<s32>((s64(delta) << 16) / steps); };
+
+    s32 x = (from.x << 16) + (1 << 15);
+    s32 y = (from.y << 16) + (1 << 15);
+    s32 r = from.r << 16;
+    s32 g = from.g << 16;
+    s32 b = from.b << 16;
+
+    s32 step_x = step(dx);
+    s32 step_y = step(dy);
+    s32 step_r = gouraud ? step(to.r - from.r) : 0;
+    s32 step_g = gouraud ? step(to.g - from.g) : 0;
+    s32 step_b = gouraud ? step(to.b - from.b) : 0;
+
+    for(s32 i = 0; i <= steps; i++)
+    {
+        plot(x >> 16, y >> 16, r >> 16, g >> 16, b >> 16, dithering, semi, state);
+
+        x += step_x;
+        y += step_y;
+        r += step_r;
+        g += step_g;
+        b += step_b;
+    }
+}
+
+void SoftwareRenderer::plot(s32 x, s32 y, s32 r, s32 g, s32 b, bool dithering, bool semi, const State& state)
+{
+    if(x < state.clip_left || x > state.clip_right || y < state.clip_top || y > state.clip_bottom)
+    {
+        return;
+    }
+
+    u16& destination = row(y)[x];
+
+    if(state.check_mask && (destination & 0x8000))
+    {
+        return;
+    }
+
+    if(dithering)
+    {
+        s8 d = DitherMatrix[y & 3][x & 3];
+
+        r = clamp_color(r + d);
+        g = clamp_color(g + d);
+        b = clamp_color(b + d);
+    }
+
+    u16 color = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10);
+
+    if(semi)
+    {
+        color = blend(destination, color, state.semi_transparency);
+    }
+
+    destination = color | (state.force_mask ? 0x8000 : 0);
+}
+
+u16 SoftwareRenderer::texel(const State& state, u8 u, u8 v) const
+{
+    u = (u & ~(state.tex_window_x_mask * 8)) | ((state.tex_window_x_offset & state.tex_window_x_mask) * 8);
+    v = (v & ~(state.tex_window_y_mask * 8)) | ((state.tex_window_y_offset & state.tex_window_y_mask) * 8);
+
+    const u16* texture_row = m_vram + ((state.texpage_y + v) & (VRAMHeight - 1)) * VRAMWidth;
+    const u16* clut        = m_vram + state.clut_y * VRAMWidth;
+
+    switch(state.tex_depth)
+    {
+        case 0: //4 bit palette indices
+        {
+            u16 word  = texture_row[(state.texpage_x + u / 4) & (VRAMWidth - 1)];
+            u8  index = (word >> ((u & 3) * 4)) & 0xF;
+
+            return clut[(state.clut_x + index) & (VRAMWidth - 1)];
+        }
+        case 1: //8 bit palette indices
+        {
+            u16 word  = texture_row[(state.texpage_x + u / 2) & (VRAMWidth - 1)];
+            u8  index = (word >> ((u & 1) * 8)) & 0xFF;
+
+            return clut[(state.clut_x + index) & (VRAMWidth - 1)];
+        }
+        default: //15 bit direct colour
+        {
+            return texture_row[(state.texpage_x + u) & (VRAMWidth - 1)];
+        }
+    }
+}
+
+u16 SoftwareRenderer::blend(u16 back, u16 front, u8 mode) const
+{
+    s32 result[3];
+
+    for(u32 i = 0; i < 3; i++)
+    {
+        s32 b = (back  >> (i * 5)) & 0x1F;
+        s32 f = (front >> (i * 5)) & 0x1F;
+
+        switch(mode)
+        {
+            case 0:  { result[i] = (b + f) >> 1; break; }
+            case 1:  { result[i] = std::min(b + f, 31); break; }
+            case 2:  { result[i] = std::max(b - f, 0); break; }
+            default: { result[i] = std::min(b + (f >> 2), 31); break; }
+        }
+    }
+
+    return result[0] | (result[1] << 5) | (result[2] << 10);
+}
+
+void SoftwareRenderer::gouraud_span_scalar(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask)
+{
+    s32 r = span.r;
+    s32 g = span.g;
+    s32 b = span.b;
+
+    for(u32 i = 0; i < count; i++, r += span.dr, g += span.dg, b += span.db)
+    {
+        s32 pr = clamp_color(r >> GradientShift);
+        s32 pg = clamp_color(g >> GradientShift);
+        s32 pb = clamp_color(b >> GradientShift);
+
+        if(dither != nullptr)
+        {
+            pr = clamp_color(pr + dither[i & 3]);
+            pg = clamp_color(pg + dither[i & 3]);
+            pb = clamp_color(pb + dither[i & 3]);
+        }
+
+        destination[i] = (pr >> 3) | ((pg >> 3) << 5) | ((pb >> 3) << 10) | mask;
+    }
+}
+
+#if defined SOFTWARE_RENDERER_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128i shade_channel_sse41(__m128i value, __m128i dither, bool dithering)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi32(255);
+
+    __m128i c = _mm_min_epi32(_mm_max_epi32(_mm_srai_epi32(value, 12), zero), full);
+
+    if(dithering)
+    {
+        c = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(c, dither), zero), full);
+    }
+
+    return _mm_srli_epi32(c, 3);
+}
+
+__attribute__((target("sse4.1")))
+void SoftwareRenderer::gouraud_span_sse41(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask)
+{
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+
+    //four lanes of each channel, every group of four keeps the same dither phase
+    __m128i r = _mm_add_epi32(_mm_set1_epi32(span.r), _mm_mullo_epi32(lanes, _mm_set1_epi32(span.dr)));
+    __m128i g = _mm_add_epi32(_mm_set1_epi32(span.g), _mm_mullo_epi32(lanes, _mm_set1_epi32(span.dg)));
+    __m128i b = _mm_add_epi32(_mm_set1_epi32(span.b), _mm_mullo_epi32(lanes, _mm_set1_epi32(span.db)));
+
+    const __m128i r_step = _mm_set1_epi32(span.dr * 4);
+    const __m128i g_step = _mm_set1_epi32(span.dg * 4);
+    const __m128i b_step = _mm_set1_epi32(span.db * 4);
+
+    bool    dithering = dither != nullptr;
+    __m128i d         = dithering ? _mm_setr_epi32(dither[0], dither[1], dither[2], dither[3]) : _mm_setzero_si128();
+    __m128i m         = _mm_set1_epi32(mask);
+
+    u32 i = 0;
+
+    for(; i + 8 <= count; i += 8)
+    {
+        __m128i pixels[2];
+
+        for(u32 half = 0; half < 2; half++)
+        {
+            __m128i pr = shade_channel_sse41(r, d, dithering);
+            __m128i pg = shade_channel_sse41(g, d, dithering);
+            __m128i pb = shade_channel_sse41(b, d, dithering);
+
+            pixels[half] = _mm_or_si128(_mm_or_si128(pr, _mm_slli_epi32(pg, 5)), _mm_or_si128(_mm_slli_epi32(pb, 10), m));
+
+            r = _mm_add_epi32(r, r_step);
+            g = _mm_add_epi32(g, g_step);
+            b = _mm_add_epi32(b, b_step);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi32(pixels[0], pixels[1]));
+    }
+
+    //the tail starts on a multiple of 4, so the dither phase carries over
+    Span tail = { span.r + span.dr * s32(i), span.g + span.dg * s32(i), span.b + span.db * s32(i), span.dr, span.dg, span.db };
+
+    gouraud_span_scalar(destination + i, count - i, tail, dither, mask);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i shade_channel_avx2(__m256i value, __m256i dither, bool dithering)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi32(255);
+
+    __m256i c = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(value, 12), zero), full);
+
+    if(dithering)
+    {
+        c = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(c, dither), zero), full);
+    }
+
+    return _mm256_srli_epi32(c, 3);
+}
+
+__attribute__((target("avx2")))
+void SoftwareRenderer::gouraud_span_avx2(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask)
+{
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i r = _mm256_add_epi32(_mm256_set1_epi32(span.r), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.dr)));
+    __m256i g = _mm256_add_epi32(_mm256_set1_epi32(span.g), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.dg)));
+    __m256i b = _mm256_add_epi32(_mm256_set1_epi32(span.b), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.db)));
+
+    const __m256i r_step = _mm256_set1_epi32(span.dr * 8);
+    const __m256i g_step = _mm256_set1_epi32(span.dg * 8);
+    const __m256i b_step = _mm256_set1_epi32(span.db * 8);
+
+    bool    dithering = dither != nullptr;
+    __m256i d         = dithering ? _mm256_setr_epi32(dither[0], dither[1], dither[2], dither[3], dither[0], dither[1], dither[2], dither[3]) : _mm256_setzero_si256();
+    __m256i m         = _mm256_set1_epi32(mask);
+
+    u32 i = 0;
+
+    for(; i + 16 <= count; i += 16)
+    {
+        __m256i pixels[2];
+
+        for(u32 half = 0; half < 2; half++)
+        {
+            __m256i pr = shade_channel_avx2(r, d, dithering);
+            __m256i pg = shade_channel_avx2(g, d, dithering);
+            __m256i pb = shade_channel_avx2(b, d, dithering);
+
+            pixels[half] = _mm256_or_si256(_mm256_or_si256(pr, _mm256_slli_epi32(pg, 5)), _mm256_or_si256(_mm256_slli_epi32(pb, 10), m));
+
+            r = _mm256_add_epi32(r, r_step);
+            g = _mm256_add_epi32(g, g_step);
+            b = _mm256_add_epi32(b, b_step);
+        }
+
+        //packing works per 128 bit lane, put the four quarters back in order
+        __m256i packed = _mm256_packus_epi32(pixels[0], pixels[1]);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    Span tail = { span.r + span.dr * s32(i), span.g + span.dg * s32(i), span.b + span.db * s32(i), span.dr, span.dg, span.db };
+
+    gouraud_span_scalar(destination + i, count - i, tail, dither, mask);
+}
+
+#else
+
+void SoftwareRenderer::gouraud_span_sse41(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask)
+{
+    gouraud_span_scalar(destination, count, span, dither, mask);
+}
+
+void SoftwareRenderer::gouraud_span_avx2(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask)
+{
+    gouraud_span_scalar(destination, count, span, dither, mask);
+}
+
+#endif
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "Types.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * software rasterizer drawing GP0 primitives into VRAM
+ *
+ * with worker threads primitives are queued, binned into 64x64 tiles on
+ * flush() and the tiles are rasterized in parallel, VRAM is only up to date
+ * after a flush
+ */
+class SoftwareRenderer
+{
+public:
+
+    static constexpr const u32 VRAMWidth  = 1024;
+    static constexpr const u32 VRAMHeight = 512;
+
+    struct Vertex
+    {
+        s32 x { 0 };
+        s32 y { 0 };
+        u8  r { 0 };
+        u8  g { 0 };
+        u8  b { 0 };
+        u8  u { 0 };
+        u8  v { 0 };
+    };
+
+    /**
+     * primitive flags, same meaning as the low bits of the polygon opcodes,
+     * the flips only apply to rectangles
+     */
+    enum Flags : u8
+    {
+        Gouraud         = 1 << 0,
+        Textured        = 1 << 1,
+        RawTexture      = 1 << 2,
+        SemiTransparent = 1 << 3,
+        FlipX           = 1 << 4,
+        FlipY           = 1 << 5
+    };
+
+    /**
+     * GPU state sampled by a primitive
+     */
+    struct State
+    {
+        //drawing area, inclusive
+        s32 clip_left   { 0 };
+        s32 clip_top    { 0 };
+        s32 clip_right  { 0 };
+        s32 clip_bottom { 0 };
+
+        //texture page and palette in VRAM pixels
+        u16 texpage_x { 0 };
+        u16 texpage_y { 0 };
+        u8  tex_depth { 0 };
+        u16 clut_x    { 0 };
+        u16 clut_y    { 0 };
+
+        u8 tex_window_x_mask   { 0 };
+        u8 tex_window_y_mask   { 0 };
+        u8 tex_window_x_offset { 0 };
+        u8 tex_window_y_offset { 0 };
+
+        u8   semi_transparency { 0 };
+        bool dithering         { false };
+        bool force_mask        { false };
+        bool check_mask        { false };
+    };
+
+    SoftwareRenderer(u16* vram);
+
+    void draw_triangle(const Vertex (&vertices)[3], u8 flags, const State& state);
+    void draw_quad(const Vertex (&vertices)[4], u8 flags, const State& state);
+
+    /**
+     * axis aligned sprite, origin holds the top left pixel, its colour and its texcoord
+     */
+    void draw_rectangle(const Vertex& origin, s32 width, s32 height, u8 flags, const State& state);
+
+    /**
+     * line with both end pixels drawn, never textured
+     */
+    void draw_line(const Vertex (&vertices)[2], u8 flags, const State& state);
+
+    /**
+     * rasterize everything queued, must happen before VRAM is read or written by anyone else
+     */
+    void flush();
+
+    /**
+     * number of threads rasterizing tiles, the calling thread included, 1 draws immediately
+     */
+    void set_threads(u32 threads);
+
+    /**
+     * gouraud span implementation, Auto takes the widest the cpu supports, the
+     * others are there to check a SIMD path against the scalar one and fall
+     * back to scalar on a cpu without it
+     */
+    enum class SpanPath : u8
+    {
+        Auto,
+        Scalar,
+        SSE41,
+        AVX2
+    };
+
+    void set_span_path(SpanPath path);
+
+private:
+
+    static constexpr const u32 TileSize = 64;
+    static constexpr const u32 TilesX   = VRAMWidth  / TileSize;
+    static constexpr const u32 TilesY   = VRAMHeight / TileSize;
+    static constexpr const u32 MaxBatch = 4096;
+
+    /**
+     * inclusive VRAM rectangle
+     */
+    struct Rect
+    {
+        s32 left   { 0 };
+        s32 top    { 0 };
+        s32 right  { -1 };
+        s32 bottom { -1 };
+
+        bool empty() const { return left > right || top > bottom; }
+
+        bool overlaps(const Rect& other) const
+        {
+            return left <= other.right && other.left <= right && top <= other.bottom && other.top <= bottom;
+        }
+
+        void merge(const Rect& other)
+        {
+            if(empty())
+            {
+                *this = other;
+                return;
+            }
+
+            left   = std::min(left,   other.left);
+            top    = std::min(top,    other.top);
+            right  = std::max(right,  other.right);
+            bottom = std::max(bottom, other.bottom);
+        }
+    };
+
+    enum class Shape : u8
+    {
+        Triangle,
+        Rectangle, // vertices[0] is the origin, vertices[1] holds the size
+        Line
+    };
+
+    struct Primitive
+    {
+        Vertex vertices[3];
+        u8     flags;
+        Shape  shape;
+        State  state;
+
+        //bounding box clipped to the drawing area and VRAM
+        Rect bounds;
+    };
+
+    /**
+     * batch a primitive or, without workers or when it samples its own output, draw it right away
+     */
+    void queue(const Primitive& primitive);
+    void rasterize(const Primitive& primitive, const State& state);
+
+    void rasterize_triangle(const Vertex (&vertices)[3], u8 flags, const State& state);
+    void rasterize_rectangle(const Vertex& origin, s32 width, s32 height, u8 flags, const State& state);
+    void rasterize_line(const Vertex (&vertices)[2], u8 flags, const State& state);
+
+    /**
+     * one shaded, blended and masked pixel of a line
+     */
+    void plot(s32 x, s32 y, s32 r, s32 g, s32 b, bool dithering, bool semi, const State& state);
+
+    /**
+     * attribute interpolated across a triangle in 12 bit fixed point
+     */
+    struct Gradient
+    {
+        s32 dx   { 0 };
+        s32 dy   { 0 };
+        s64 base { 0 }; // value at (0, 0), rounding included
+
+        s32 at(s32 x, s32 y) const { return static_cast<s32>(base + s64(dx) * x + s64(dy) * y); }
+    };
+
+    static constexpr const u32 GradientShift = 12;
+
+    /**
+     * colour channels of a gouraud span, start values and per pixel steps
+     */
+    struct Span
+    {
+        s32 r, g, b;
+        s32 dr, dg, db;
+    };
+
+    using GouraudSpanFn = void (*)(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask);
+
+    static void gouraud_span_scalar(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask);
+    static void gouraud_span_sse41(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask);
+    static void gouraud_span_avx2(u16* destination, u32 count, const Span& span, const s8* dither, u16 mask);
+
+    u16  texel(const State& state, u8 u, u8 v) const;
+    u16  blend(u16 back, u16 front, u8 mode) const;
+
+    u16* row(s32 y) { return m_vram + y * VRAMWidth; }
+
+    u16*          m_vram;
+    GouraudSpanFn m_gouraud_span;
+
+    //queued primitives, everything they draw to and everything they sample from
+    std::vector<Primitive> m_batch;
+    Rect                   m_batch_written;
+    Rect                   m_batch_sampled;
+
+    //primitive indices per tile and the tiles with work in them
+    std::vector<u32> m_tiles[TilesX * TilesY];
+    std::vector<u32> m_busy_tiles;
+
+    WorkerPool m_pool;
+};
@@ -0,0 +1,223 @@
+#include "TextureCache.hpp"
+
+void TextureCache::init()
+{
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16UI, PageSize, PageSize, Layers, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+}
+
+void TextureCache::destroy()
+{
+    glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    
+    m_entries.clear();
+}
+
+void TextureCache::clear()
+{
+    m_entries.clear();
+}
+
+void TextureCache::upload(u16 layer)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, PageSize, PageSize, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_decoded);
+}
+
+u16 TextureCache::lookup(const u16* vram, u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y)
+{
+    //15 bit pages have no palette
+    if(depth >= 2)
+    {
+        depth  = 2;
+        clut_x = 0;
+        clut_y = 0;
+    }
+    
+    u32 key = (texpage_x / 64) | ((texpage_y / 256) << 4) | (depth << 5) | ((clut_x / 16) << 7) | (clut_y << 13);
+    
+    auto it = m_entries.find(key);
+    
+    if(it != m_entries.end())
+    {
+        Entry& entry = it->second;
+        
+        u64 current = stamp(entry);
+        
+        if(current == entry.stamp)
+        {
+            return entry.layer;
+        }
+        
+        entry.stamp = current;
+        
+        //something was written nearby, the texture is still good if the source reads the same
+        u64 current_hash = hash(vram, entry);
+        
+        if(current_hash == entry.hash)
+        {
+            return entry.layer;
+        }
+        
+        entry.hash = current_hash;
+        
+        if(m_overwrite)
+        {
+            m_overwrite();
+        }
+        
+        decode(vram, texpage_x, texpage_y, depth, clut_x, clut_y);
+        upload(entry.layer);
+        
+        return entry.layer;
+    }
+    
+    if(full())
+    {
+        if(m_overwrite)
+        {
+            m_overwrite();
+        }
+        
+        clear();
+    }
+    
+    Entry entry;
+    
+    //entries are only ever dropped all at once, so the next free layer is the entry count
+    entry.layer = m_entries.size();
+    
+    entry.sources[entry.source_count++] = { texpage_x, texpage_y, static_cast<u16>(64 << depth), PageSize };
+    
+    if(depth < 2)
+    {
+        entry.sources[entry.source_count++] = { clut_x, clut_y, static_cast<u16>(depth == 0 ? 16 : 256), 1 };
+    }
+    
+    entry.stamp = stamp(entry);
+    entry.hash  = hash(vram, entry);
+    
+    decode(vram, texpage_x, texpage_y, depth, clut_x, clut_y);
+    upload(entry.layer);
+    
+    m_entries.emplace(key, entry);
+    
+    return entry.layer;
+}
+
+void TextureCache::invalidate(u16 x, u16 y, u16 width, u16 height)
+{
+    if(width == 0 || height == 0)
+    {
+        return;
+    }
+    
+    u32 first_x = x / BlockWidth;
+    u32 last_x  = (x + width - 1) / BlockWidth;
+    u32 first_y = y / BlockHeight;
+    u32 last_y  = (y + height - 1) / BlockHeight;
+    
+    for(u32 by = first_y; by <= last_y; by++)
+    {
+        for(u32 bx = first_x; bx <= last_x; bx++)
+        {
+            m_generations[by % BlocksY][bx % BlocksX]++;
+        }
+    }
+}
+
+u64 TextureCache::stamp(const Entry& entry) const
+{
+    u64 sum = 0;
+    
+    for(u32 i = 0; i < entry.source_count; i++)
+    {
+        const Source& source = entry.sources[i];
+        
+        u32 first_x = source.x / BlockWidth;
+        u32 last_x  = (source.x + source.width - 1) / BlockWidth;
+        u32 first_y = source.y / BlockHeight;
+        u32 last_y  = (source.y + source.height - 1) / BlockHeight;
+        
+        for(u32 by = first_y; by <= last_y; by++)
+        {
+            for(u32 bx = first_x; bx <= last_x; bx++)
+            {
+                sum += m_generations[by % BlocksY][bx % BlocksX];
+            }
+        }
+    }
+    
+    return sum;
+}
+
+u64 TextureCache::hash(const u16* vram, const Entry& entry) const
+{
+    //FNV-1a over the source texels
+    u64 h = 0xCBF29CE484222325;
+    
+    for(u32 i = 0; i < entry.source_count; i++)
+    {
+        const Source& source = entry.sources[i];
+        
+        for(u32 row = 0; row < source.height; row++)
+        {
+            const u16* line = vram + ((source.y + row) & (VRAMHeight - 1)) * VRAMWidth;
+            
+            for(u32 column = 0; column < source.width; column++)
+            {
+                h = (h ^ line[(source.x + column) & (VRAMWidth - 1)]) * 0x100000001B3;
+            }
+        }
+    }
+    
+    return h;
+}
+
+void TextureCache::decode(const u16* vram, u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y)
+{
+    const u16* clut = vram + clut_y * VRAMWidth;
+    
+    for(u32 v = 0; v < PageSize; v++)
+    {
+        const u16* line = vram + ((texpage_y + v) & (VRAMHeight - 1)) * VRAMWidth;
+        u16*       out  = m_decoded + v * PageSize;
+        
+        switch(depth)
+        {
+            case 0: //4 bit palette indices
+            {
+                for(u32 u = 0; u < PageSize; u++)
+                {
+                    u16 word = line[(texpage_x + u / 4) & (VRAMWidth - 1)];
+                    out[u]   = clut[(clut_x + ((word >> ((u & 3) * 4)) & 0xF)) & (VRAMWidth - 1)];
+                }
+                
+                break;
+            }
+            case 1: //8 bit palette indices
+            {
+                for(u32 u = 0; u < PageSize; u++)
+                {
+                    u16 word = line[(texpage_x + u / 2) & (VRAMWidth - 1)];
+                    out[u]   = clut[(clut_x + ((word >> ((u & 1) * 8)) & 0xFF)) & (VRAMWidth - 1)];
+                }
+                
+                break;
+            }
+            default: //15 bit direct colour
+            {
+                for(u32 u = 0; u < PageSize; u++)
+                {
+                    out[u] = line[(texpage_x + u) & (VRAMWidth - 1)];
+                }
+                
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Types.hpp"
+
+#if defined  __WIN__
+#define NOMINMAX
+#include <Windows.h>
+#include <GL/glew.h>
+#elif defined __OSX__
+#define GL_SILENCE_DEPRECATION
+#include <OpenGL/gl3.h>
+#elif defined __LNX__
+#include <OpenGL/glew.h>
+#endif
+
+#include <functional>
+#include <unordered_map>
+
+/**
+ * texture pages decoded for the OpenGL renderer
+ *
+ * a (texpage, clut, depth) tuple is decoded once into a 256x256 layer of an
+ * array texture, 15 bit texels with the palette already applied. VRAM writes only bump the
+ * generation of the blocks they touch, an entry whose blocks moved on is
+ * rehashed on its next lookup and decoded again only if its source changed
+ */
+class TextureCache
+{
+public:
+    
+    static constexpr const u32 VRAMWidth  = 1024;
+    static constexpr const u32 VRAMHeight = 512;
+    static constexpr const u32 PageSize   = 256;
+    static constexpr const u32 Layers     = 128;
+    
+    TextureCache() {}
+    
+    void init();
+    void destroy();
+    
+    /**
+     * forget every page, their layers are reused
+     */
+    void clear();
+    
+    /**
+     * the next miss throws every page away
+     */
+    bool full() const { return m_entries.size() >= Layers; }
+    
+    /**
+     * called right before a layer that may already be sampled is decoded again,
+     * either because the cache is full or because the page under it changed
+     */
+    void on_overwrite(std::function<void()> callback) { m_overwrite = std::move(callback); }
+    
+    GLuint texture() const { return m_texture; }
+    
+    /**
+     * layer holding a page, decoded from vram if it is missing or its source changed
+     */
+    u16 lookup(const u16* vram, u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y);
+    
+    /**
+     * note a write to vram, entries reading from the rectangle are revalidated on their next lookup
+     */
+    void invalidate(u16 x, u16 y, u16 width, u16 height);
+    
+private:
+    
+    //VRAM is tracked in blocks the size of a 4 bit texture page
+    static constexpr const u32 BlockWidth  = 64;
+    static constexpr const u32 BlockHeight = 256;
+    static constexpr const u32 BlocksX     = VRAMWidth  / BlockWidth;
+    static constexpr const u32 BlocksY     = VRAMHeight / BlockHeight;
+    
+    /**
+     * VRAM rectangle an entry reads, wraps around horizontally
+     */
+    struct Source
+    {
+        u16 x;
+        u16 y;
+        u16 width;
+        u16 height;
+    };
+    
+    struct Entry
+    {
+        u16    layer   { 0 };
+        u64    hash    { 0 };
+        
+        //sum of the generations of every block the sources touch, generations only grow
+        u64    stamp   { 0 };
+        
+        Source sources[2];
+        u32    source_count { 0 };
+    };
+    
+    u64  stamp(const Entry& entry) const;
+    u64  hash(const u16* vram, const Entry& entry) const;
+    void decode(const u16* vram, u16 texpage_x, u16 texpage_y, u8 depth, u16 clut_x, u16 clut_y);
+    void upload(u16 layer);
+    
+    GLuint m_texture { 0 };
+    
+    u32 m_generations[BlocksY][BlocksX] {};
+    
+    std::unordered_map<u32, Entry> m_entries;
+    
+    std::function<void()> m_overwrite;
+    
+    //decoded page waiting for upload
+    u16 m_decoded[PageSize * PageSize];
+};
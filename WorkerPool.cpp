@@ -0,0 +1,98 @@
+#include "WorkerPool.hpp"
+
+void WorkerPool::start(u32 workers)
+{
+    stop();
+    
+    m_quit = false;
+    
+    for(u32 i = 0; i < workers; i++)
+    {
+        m_threads.emplace_back(&WorkerPool::worker, this);
+    }
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    
+    m_wake.notify_all();
+    
+    for(std::thread& thread : m_threads)
+    {
+        thread.join();
+    }
+    
+    m_threads.clear();
+}
+
+void WorkerPool::run(u32 jobs, const std::function<void(u32)>& fn)
+{
+    if(m_threads.empty() || jobs <= 1)
+    {
+        for(u32 i = 0; i < jobs; i++)
+        {
+            fn(i);
+        }
+        
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        
+        m_fn   = &fn;
+        m_jobs = jobs;
+        m_busy = m_threads.size();
+        m_next.store(0);
+        m_generation++;
+    }
+    
+    m_wake.notify_all();
+    
+    work();
+    
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_busy == 0; });
+    m_fn = nullptr;
+}
+
+void WorkerPool::worker()
+{
+    u32 generation = 0;
+    
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_quit || m_generation != generation; });
+            
+            if(m_quit)
+            {
+                return;
+            }
+            
+            generation = m_generation;
+        }
+        
+        work();
+        
+        std::lock_guard<std::mutex> lock(m_mutex);
+        
+        if(--m_busy == 0)
+        {
+            m_done.notify_one();
+        }
+    }
+}
+
+void WorkerPool::work()
+{
+    for(u32 job = m_next++; job < m_jobs; job = m_next++)
+    {
+        (*m_fn)(job);
+    }
+}
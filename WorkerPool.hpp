@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * fixed set of threads running parallel-for style jobs
+ */
+class WorkerPool
+{
+public:
+    
+    WorkerPool() {}
+   ~WorkerPool() { stop(); }
+    
+    void start(u32 workers);
+    void stop();
+    
+    u32 workers() const { return m_threads.size(); }
+    
+    /**
+     * call fn(job) for every job in [0, jobs), the calling thread helps out
+     * and the call returns once all jobs have finished
+     */
+    void run(u32 jobs, const std::function<void(u32)>& fn);
+    
+private:
+    
+    void worker();
+    void work();
+    
+    std::vector<std::thread> m_threads;
+    
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    
+    const std::function<void(u32)>* m_fn { nullptr };
+    
+    u32              m_jobs       { 0 };
+    std::atomic<u32> m_next       { 0 };
+    u32              m_busy       { 0 };
+    u32              m_generation { 0 };
+    bool             m_quit       { false };
+};
@@ -6,10 +6,9 @@
 
 int main(int argc, const char* argv[])
 {	
-	MARK_AS_USED(argc);
-	MARK_AS_USED(argv);
+    Config config = Config::parse(argc, argv);
 	
     CPU* cpu = new CPU();
-    cpu->init(argv[1]);
+    cpu->init(config);
     cpu->run();
 }
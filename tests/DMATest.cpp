@@ -0,0 +1,162 @@
+#include "Test.hpp"
+#include "../CPU.hpp"
+
+#include <memory>
+
+#ifdef main
+#undef main
+#endif
+
+namespace
+{
+    /**
+     * the devices of a CPU without a BIOS, DMA events are run by hand
+     */
+    class TestCPU : public CPU
+    {
+    public:
+    
+        TestCPU()
+        {
+            Config config;
+            config.renderer = Config::RendererType::Null;
+            config.headless = true;
+            
+            m_gpu.configure(config);
+        }
+        
+        u32  read(u32 address)              { return m_mmu.read<u32>(address); }
+        void write(u32 address, u32 value)  { m_mmu.write<u32>(address, value); }
+        
+        /**
+         * run DMA events until none is left, false if it takes more than steps of them
+         */
+        bool run_dma(u32 steps)
+        {
+            for(u32 i = 0; i < steps; i++)
+            {
+                if(!m_scheduler.pending(Scheduler::Event::DMA))
+                {
+                    return true;
+                }
+                
+                m_scheduler.skip_to_next_event();
+            }
+            
+            return !m_scheduler.pending(Scheduler::Event::DMA);
+        }
+        
+        const DMA::Stats& dma_stats() const { return m_dma.frame_stats(); }
+    };
+    
+    constexpr const u32 GPUBase  = 0x1F8010A0;
+    constexpr const u32 GPUBlock = 0x1F8010A4;
+    constexpr const u32 GPUCtrl  = 0x1F8010A8;
+    constexpr const u32 OTCBase  = 0x1F8010E0;
+    constexpr const u32 OTCBlock = 0x1F8010E4;
+    constexpr const u32 OTCCtrl  = 0x1F8010E8;
+    constexpr const u32 DICR     = 0x1F8010F4;
+    
+    //master enable and the channel 2 enable, the channel 2 flag
+    constexpr const u32 DICRGPU     = (1 << 23) | (1 << 18);
+    constexpr const u32 DICRGPUFlag = 1 << 26;
+    
+    //start, linked list sync, from RAM
+    constexpr const u32 LListFromRAM = 0x01000401;
+    
+    //start and trigger, manual sync, to RAM, decrementing
+    constexpr const u32 OTCClear = 0x11000002;
+    
+    void check_llist_stops(TestCPU& cpu, u32 start)
+    {
+        cpu.write(DICR, DICRGPU);
+        cpu.write(GPUBase, start);
+        cpu.write(GPUBlock, 0);
+        cpu.write(GPUCtrl, LListFromRAM);
+        
+        CHECK(cpu.run_dma(1000));
+        
+        CHECK_EQ(cpu.dma_stats().llist_aborts, 1u);
+        CHECK_EQ(cpu.read(GPUCtrl) & (1 << 24), 0u);
+        CHECK_EQ(cpu.read(DICR) & DICRGPUFlag, DICRGPUFlag);
+    }
+}
+
+TEST(dma_self_looping_ordering_table_stops)
+{
+    std::unique_ptr<TestCPU> cpu(new TestCPU());
+    
+    //a node without payload pointing at itself
+    cpu->write(0x1000, 0x00001000);
+    
+    check_llist_stops(*cpu, 0x1000);
+}
+
+TEST(dma_looping_ordering_table_with_payload_stops)
+{
+    std::unique_ptr<TestCPU> cpu(new TestCPU());
+    
+    //a terminated list would end at 0x3000, the last node points back at the second one instead
+    cpu->write(0x1000, 0x01002000);
+    cpu->write(0x1004, 0x00000000);
+    cpu->write(0x2000, 0x02003000);
+    cpu->write(0x2004, 0x00000000);
+    cpu->write(0x2008, 0x00000000);
+    cpu->write(0x3000, 0x00002000);
+    
+    check_llist_stops(*cpu, 0x1000);
+}
+
+TEST(dma_terminated_ordering_table_completes)
+{
+    std::unique_ptr<TestCPU> cpu(new TestCPU());
+    
+    cpu->write(0x1000, 0x01002000);
+    cpu->write(0x1004, 0x00000000);
+    cpu->write(0x2000, 0x00FFFFFF);
+    
+    cpu->write(DICR, DICRGPU);
+    cpu->write(GPUBase, 0x1000);
+    cpu->write(GPUBlock, 0);
+    cpu->write(GPUCtrl, LListFromRAM);
+    
+    CHECK(cpu->run_dma(1000));
+    
+    CHECK_EQ(cpu->dma_stats().llist_aborts, 0u);
+    CHECK_EQ(cpu->dma_stats().llist_nodes, 2u);
+    CHECK_EQ(cpu->read(GPUCtrl) & (1 << 24), 0u);
+    CHECK_EQ(cpu->read(DICR) & DICRGPUFlag, DICRGPUFlag);
+}
+
+TEST(dma_otc_builds_a_terminated_chain)
+{
+    std::unique_ptr<TestCPU> cpu(new TestCPU());
+    
+    //the table is longer than a burst so it takes several steps
+    const u32 entries = 2000;
+    const u32 top     = 0x10000 + (entries - 1) * 4;
+    
+    cpu->write(0x10000 - 4, 0xDEADBEEF);
+    cpu->write(top + 4, 0xDEADBEEF);
+    
+    cpu->write(OTCBase, top);
+    cpu->write(OTCBlock, entries);
+    cpu->write(OTCCtrl, OTCClear);
+    
+    CHECK(cpu->run_dma(1000));
+    
+    for(u32 address = 0x10000 + 4; address <= top; address += 4)
+    {
+        u32 i = address >> 2;
+        
+        CHECK_EQ(cpu->read(address), ((i - 1) << 2) & 0x1FFFFF);
+    }
+    
+    CHECK_EQ(cpu->read(0x10000), 0x00FFFFFFu);
+    
+    //nothing outside the table is touched
+    CHECK_EQ(cpu->read(0x10000 - 4), 0xDEADBEEFu);
+    CHECK_EQ(cpu->read(top + 4), 0xDEADBEEFu);
+    
+    CHECK_EQ(cpu->read(OTCCtrl) & (1 << 24), 0u);
+}
@@ -0,0 +1,98 @@
+#include "Test.hpp"
+#include "TestGPU.hpp"
+#include "../FrameDump.hpp"
+#include "../File.hpp"
+
+#include <cstdio>
+
+namespace
+{
+    //black, red, green, blue / white, darkest grey with the mask bit, half red, half grey
+    constexpr const u16 Pattern[8] =
+    {
+        0x0000, 0x001F, 0x03E0, 0x7C00,
+        0x7FFF, 0x8421, 0x0010, 0x4210
+    };
+    
+    const std::vector<u8> PatternRGB =
+    {
+        0,   0,   0,     255, 0,   0,     0,   255, 0,     0,   0,   255,
+        255, 255, 255,   8,   8,   8,     132, 0,   0,     132, 132, 132
+    };
+    
+    //pinned so a change to the conversion or the hash shows up before a whole hash corpus goes stale
+    constexpr const u64 PatternHash = 0xC13DFA8146EFFD1C;
+}
+
+TEST(frame_dump_converts_15_bit_pixels)
+{
+    std::vector<u16> vram(1024 * 512, 0);
+    
+    //the area starts 2 pixels before the right edge and wraps around to the left
+    for(u32 i = 0; i < 8; i++)
+    {
+        vram[(10 + i / 4) * 1024 + (1022 + i % 4) % 1024] = Pattern[i];
+    }
+    
+    std::vector<u8> rgb;
+    FrameDump::convert(rgb, vram.data(), 1022, 10, 4, 2, false);
+    
+    CHECK(rgb == PatternRGB);
+    CHECK_EQ(FrameDump::hash(rgb.data(), rgb.size()), PatternHash);
+}
+
+TEST(frame_dump_hashes_the_display_in_its_depth)
+{
+    const char* path = "frame_dump_test_hashes.txt";
+    
+    std::vector<u8> rgb24;
+    
+    {
+        Config config;
+        config.frame_hash_path = path;
+        
+        TestGPU gpu(config);
+        
+        gpu.load_image(0, 0, 4, 2, Pattern);
+        
+        //320 wide, 16 dot clock ticks and 2 lines are a 4x2 area at the top left of VRAM
+        gpu.gp1(0x05000000);
+        gpu.gp1(0x06000000 | 0x200 | ((0x200 + 16) << 12));
+        gpu.gp1(0x07000000 | 0x10  | ((0x10  + 2)  << 10));
+        gpu.gp1(0x03000000);
+        
+        gpu.gp1(0x08000001);
+        gpu.vblank();
+        
+        //bit 4 switches to 24 bit, the same words are read as packed RGB888
+        gpu.gp1(0x08000011);
+        gpu.vblank();
+        
+        FrameDump::convert(rgb24, gpu.vram(), 0, 0, 4, 2, true);
+    }
+    
+    File file(path);
+    std::string text = file.read_text();
+    file.close();
+    std::remove(path);
+    
+    unsigned           number[2] = {};
+    unsigned long long hash[2]   = {};
+    unsigned           width[2]  = {};
+    unsigned           height[2] = {};
+    
+    int fields = std::sscanf(text.c_str(), "%u %llx %ux%u %u %llx %ux%u",
+                             &number[0], &hash[0], &width[0], &height[0],
+                             &number[1], &hash[1], &width[1], &height[1]);
+    
+    CHECK_EQ(fields, 8);
+    
+    CHECK_EQ(number[0], 0u);
+    CHECK_EQ(width[0],  4u);
+    CHECK_EQ(height[0], 2u);
+    CHECK_EQ(hash[0],   PatternHash);
+    
+    CHECK_EQ(number[1], 1u);
+    CHECK_EQ(hash[1],   FrameDump::hash(rgb24.data(), rgb24.size()));
+    CHECK(hash[1] != hash[0]);
+}
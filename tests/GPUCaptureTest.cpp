@@ -0,0 +1,147 @@
+#include "Test.hpp"
+#include "../GPUCapture.hpp"
+
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    const char* const CapturePath   = "gpu_capture_test.cap";
+    const char* const TruncatedPath = "gpu_capture_test_cut.cap";
+    
+    struct Expected
+    {
+        GPUCapture::Record record;
+        u64                cycle;
+        std::vector<u32>   words;
+    };
+    
+    //the deltas cross the 1, 2, 3 and 5 byte varint boundaries
+    const std::vector<Expected> Records =
+    {
+        { GPUCapture::Record::GP1,      0,                                 { 0x00000000 } },
+        { GPUCapture::Record::GP0,      0x7F,                              { 0xE1000600 } },
+        { GPUCapture::Record::GP0,      0x7F + 0x80,                       { 0x02FF00FF } },
+        { GPUCapture::Record::GP0Burst, 0xFF + 0x4000,                     { 0x20FF0000, 0x00000000, 0x00100000, 0x00000010 } },
+        { GPUCapture::Record::GPURead,  0x40FF + 0x100000000,              { 0x7FFF001F, 0x03E07C00 } },
+        { GPUCapture::Record::VBlank,   0x1000040FF + 0x100000001,         {} },
+        { GPUCapture::Record::GP1,      0x2000040FF + 0x100000001,         { 0x03000001 } }
+    };
+    
+    void write_records()
+    {
+        GPUCapture capture;
+        
+        CHECK(capture.open(CapturePath));
+        
+        for(const Expected& expected : Records)
+        {
+            capture.write(expected.record, expected.cycle, expected.words.data(), expected.words.size());
+        }
+        
+        capture.close();
+    }
+    
+    std::vector<u8> read_file(const char* path)
+    {
+        std::vector<u8> data;
+        
+        if(std::FILE* file = std::fopen(path, "rb"))
+        {
+            u8 byte[4096];
+            
+            while(size_t size = std::fread(byte, 1, sizeof(byte), file))
+            {
+                data.insert(data.end(), byte, byte + size);
+            }
+            
+            std::fclose(file);
+        }
+        
+        return data;
+    }
+    
+    void write_file(const char* path, const std::vector<u8>& data, size_t size)
+    {
+        std::FILE* file = std::fopen(path, "wb");
+        
+        std::fwrite(data.data(), 1, size, file);
+        std::fclose(file);
+    }
+}
+
+TEST(gpu_capture_round_trip)
+{
+    write_records();
+    
+    GPUCaptureReader reader;
+    
+    CHECK(reader.open(CapturePath));
+    
+    GPUCapture::Record      record;
+    u64                     cycle;
+    const std::vector<u32>* words;
+    
+    for(const Expected& expected : Records)
+    {
+        CHECK(reader.next(record, cycle, words));
+        
+        CHECK_EQ(static_cast<u8>(record), static_cast<u8>(expected.record));
+        CHECK_EQ(cycle, expected.cycle);
+        CHECK(*words == expected.words);
+    }
+    
+    CHECK(!reader.next(record, cycle, words));
+    
+    std::remove(CapturePath);
+}
+
+TEST(gpu_capture_truncated_file_ends_cleanly)
+{
+    write_records();
+    
+    std::vector<u8> data = read_file(CapturePath);
+    
+    //magic and version
+    const size_t header = sizeof(GPUCapture::Magic) + 4;
+    
+    CHECK(data.size() > header);
+    
+    size_t last = 0;
+    
+    //every cut from an empty capture to one byte short of the whole file
+    for(size_t size = header; size < data.size(); size++)
+    {
+        write_file(TruncatedPath, data, size);
+        
+        GPUCaptureReader reader;
+        
+        CHECK(reader.open(TruncatedPath));
+        
+        GPUCapture::Record      record;
+        u64                     cycle;
+        const std::vector<u32>* words;
+        
+        size_t count = 0;
+        
+        while(reader.next(record, cycle, words))
+        {
+            CHECK(count < Records.size());
+            CHECK_EQ(cycle, Records[count].cycle);
+            
+            count++;
+        }
+        
+        //a longer cut never reads fewer records and a cut one never reads a partial one
+        CHECK(count >= last);
+        CHECK(count < Records.size());
+        
+        last = count;
+    }
+    
+    //only the last record is lost when its final byte is cut
+    CHECK_EQ(last, Records.size() - 1);
+    
+    std::remove(CapturePath);
+    std::remove(TruncatedPath);
+}
@@ -0,0 +1,162 @@
+#include "Test.hpp"
+#include "TestGPU.hpp"
+
+#include <vector>
+
+namespace
+{
+    constexpr u32 vertex(s32 x, s32 y)
+    {
+        return static_cast<u32>((x & 0xFFFF) | (y << 16));
+    }
+    
+    constexpr const u16 Red   = 0x001F;
+    constexpr const u16 Green = 0x03E0;
+    constexpr const u16 Blue  = 0x7C00;
+    
+    /**
+     * a mono and a shaded polyline, each ended by a terminator, both followed
+     * by a rectangle which only draws if the polyline let go of the parser
+     */
+    const std::vector<u32> Polylines =
+    {
+        0x480000FF, vertex(10, 10), vertex(50, 10), vertex(50, 40), 0x55555555,
+        0x6000FF00, vertex(100, 10), vertex(4, 4),
+        
+        0x58FF0000, vertex(10, 100), 0x0000FF00, vertex(60, 100), 0x000000FF, vertex(60, 150), 0x50005000,
+        0x600000FF, vertex(100, 100), vertex(4, 4)
+    };
+    
+    void check_polylines(TestGPU& gpu)
+    {
+        //mono: every vertex, both segments and nothing off them
+        CHECK_EQ(gpu.pixel(10, 10), Red);
+        CHECK_EQ(gpu.pixel(30, 10), Red);
+        CHECK_EQ(gpu.pixel(50, 10), Red);
+        CHECK_EQ(gpu.pixel(50, 25), Red);
+        CHECK_EQ(gpu.pixel(50, 40), Red);
+        CHECK_EQ(gpu.pixel(30, 11), 0x0000);
+        CHECK_EQ(gpu.pixel(50, 41), 0x0000);
+        
+        CHECK_EQ(gpu.pixel(100, 10), Green);
+        CHECK_EQ(gpu.pixel(103, 13), Green);
+        
+        //shaded: each vertex takes its own colour, the second segment starts with the colour the first ended on
+        CHECK_EQ(gpu.pixel(10, 100), Blue);
+        CHECK_EQ(gpu.pixel(60, 100), Green);
+        CHECK_EQ(gpu.pixel(60, 150), Red);
+        CHECK_EQ(gpu.pixel(60, 151), 0x0000);
+        CHECK_EQ(gpu.pixel(35, 100) & Red, 0);
+        CHECK(gpu.pixel(60, 125) & Red);
+        CHECK(gpu.pixel(60, 125) & Green);
+        
+        CHECK_EQ(gpu.pixel(100, 100), Red);
+        CHECK_EQ(gpu.pixel(103, 103), Red);
+    }
+}
+
+TEST(gpu_polylines_word_by_word)
+{
+    TestGPU gpu;
+    gpu.full_drawing_area();
+    
+    for(u32 word : Polylines)
+    {
+        gpu.gp0({ word });
+    }
+    
+    check_polylines(gpu);
+}
+
+TEST(gpu_polylines_in_one_burst)
+{
+    TestGPU gpu;
+    gpu.full_drawing_area();
+    
+    gpu.gp0_burst(Polylines, Polylines.size());
+    
+    check_polylines(gpu);
+}
+
+TEST(gpu_polylines_split_across_bursts)
+{
+    //every split point, the terminators and the following commands included
+    for(size_t count = 1; count < Polylines.size(); count++)
+    {
+        TestGPU gpu;
+        gpu.full_drawing_area();
+        
+        gpu.gp0_burst(Polylines, count);
+        
+        check_polylines(gpu);
+    }
+}
+
+TEST(gpu_clear_fifo_drops_a_partial_packet)
+{
+    TestGPU gpu;
+    gpu.full_drawing_area();
+    
+    //half a rectangle, then a whole one which would otherwise be read as its size
+    gpu.gp0({ 0x600000FF, vertex(10, 10) });
+    gpu.gp1(0x01000000);
+    gpu.gp0({ 0x6000FF00, vertex(20, 20), vertex(2, 2) });
+    
+    CHECK_EQ(gpu.pixel(10, 10), 0x0000);
+    CHECK_EQ(gpu.pixel(20, 20), Green);
+    CHECK_EQ(gpu.pixel(21, 21), Green);
+}
+
+TEST(gpu_clear_fifo_ends_an_image_load)
+{
+    TestGPU gpu;
+    gpu.full_drawing_area();
+    
+    //a 4x2 load cut short after the first row and half of the second
+    gpu.gp0({ 0xA0000000, vertex(30, 30), vertex(4, 2) });
+    gpu.gp0({ 0x001F001F, 0x001F001F, 0x03E003E0 });
+    gpu.gp1(0x01000000);
+    
+    //read as a command, not as pixels
+    gpu.gp0({ 0x60FF0000, vertex(40, 40), vertex(1, 1) });
+    
+    CHECK_EQ(gpu.pixel(30, 30), Red);
+    CHECK_EQ(gpu.pixel(33, 30), Red);
+    CHECK_EQ(gpu.pixel(30, 31), Green);
+    CHECK_EQ(gpu.pixel(31, 31), Green);
+    CHECK_EQ(gpu.pixel(32, 31), 0x0000);
+    CHECK_EQ(gpu.pixel(40, 40), Blue);
+}
+
+TEST(gpu_reset_restores_the_power_on_state)
+{
+    TestGPU gpu;
+    gpu.full_drawing_area();
+    
+    //draw mode, mask, display and dma settings, an unfinished packet and a pending readback
+    gpu.gp0({ 0xE10007FF, 0xE6000003, 0xC0000000, vertex(0, 0), vertex(4, 4) });
+    gpu.gp1(0x03000000);
+    gpu.gp1(0x04000003);
+    gpu.gp1(0x08000037);
+    gpu.gp0({ 0x600000FF, vertex(10, 10) });
+    
+    CHECK(gpu.stat() & (1 << 27));
+    
+    gpu.gp1(0x00000000);
+    
+    u32 stat = gpu.stat();
+    
+    //draw mode and mask bits, field, display depth, display enable, dma and readback
+    CHECK_EQ(stat & 0x7FFF, 0x2000u);
+    CHECK_EQ(stat & (1 << 21), 0u);
+    CHECK_EQ(stat & (1 << 23), 1u << 23);
+    CHECK_EQ(stat & (3u << 29), 0u);
+    CHECK_EQ(stat & (1 << 27), 0u);
+    
+    //the partial rectangle is gone
+    gpu.full_drawing_area();
+    gpu.gp0({ 0x6000FF00, vertex(20, 20), vertex(1, 1) });
+    
+    CHECK_EQ(gpu.pixel(10, 10), 0x0000);
+    CHECK_EQ(gpu.pixel(20, 20), Green);
+}
@@ -0,0 +1,150 @@
+#include "Test.hpp"
+#include "TestGPU.hpp"
+
+#include <vector>
+
+namespace
+{
+    constexpr u32 vertex(s32 x, s32 y)
+    {
+        return static_cast<u32>((x & 0xFFFF) | (y << 16));
+    }
+    
+    /**
+     * pixels covered once and twice by an additive quad of colour 8, 8, 8
+     * on black, that is 1 or 2 in every 5 bit channel
+     */
+    void count_coverage(TestGPU& gpu, u32& once, u32& twice)
+    {
+        const u16* vram = gpu.vram();
+        
+        once  = 0;
+        twice = 0;
+        
+        for(u32 i = 0; i < 1024 * 512; i++)
+        {
+            once  += vram[i] == 0x0421;
+            twice += vram[i] != 0x0000 && vram[i] != 0x0421;
+        }
+    }
+    
+    /**
+     * gouraud triangles wide enough for the vector loops, dithered and not,
+     * a semi transparent rectangle and lines across several tiles
+     */
+    void draw_scene(TestGPU& gpu)
+    {
+        gpu.full_drawing_area();
+        
+        gpu.gp0({ 0xE1000200 });
+        gpu.gp0({ 0x30FF0000, vertex(3, 5),   0x0000FF00, vertex(301, 17),  0x000000FF, vertex(40, 200) });
+        gpu.gp0({ 0x30102030, vertex(90, 60), 0x00F0E0D0, vertex(500, 90),  0x00808080, vertex(260, 400) });
+        
+        gpu.gp0({ 0xE1000000 });
+        gpu.gp0({ 0x38FF00FF, vertex(600, 10), 0x0000FFFF, vertex(1000, 30), 0x00FFFF00, vertex(620, 300), 0x00000000, vertex(990, 280) });
+        
+        gpu.gp0({ 0xE1000020 });
+        gpu.gp0({ 0x62404040, vertex(100, 100), vertex(700, 200) });
+        
+        gpu.gp0({ 0x40FFFFFF, vertex(0, 0),    vertex(1023, 511) });
+        gpu.gp0({ 0x50FF0000, vertex(5, 500),  0x000000FF, vertex(900, 3) });
+    }
+}
+
+TEST(software_triangles_sharing_an_edge_cover_every_pixel_once)
+{
+    TestGPU gpu;
+    
+    gpu.full_drawing_area();
+    gpu.gp0({ 0xE1000020 });
+    
+    //a square split along its diagonal
+    gpu.gp0({ 0x2A080808, vertex(10, 10), vertex(42, 10), vertex(10, 42), vertex(42, 42) });
+    
+    u32 once  = 0;
+    u32 twice = 0;
+    
+    count_coverage(gpu, once, twice);
+    
+    CHECK_EQ(twice, 0u);
+    CHECK_EQ(once,  32u * 32u);
+    
+    //the top left corner is in, the right column and bottom row are out
+    CHECK_EQ(gpu.pixel(10, 10), 0x0421);
+    CHECK_EQ(gpu.pixel(41, 41), 0x0421);
+    CHECK_EQ(gpu.pixel(42, 41), 0x0000);
+    CHECK_EQ(gpu.pixel(41, 42), 0x0000);
+}
+
+TEST(software_skewed_triangles_sharing_an_edge_cover_every_pixel_once)
+{
+    TestGPU gpu;
+    
+    gpu.full_drawing_area();
+    gpu.gp0({ 0xE1000020 });
+    
+    //a parallelogram tiles the plane by its edges, so with a consistent fill rule
+    //it covers exactly its area in pixels whatever the slope of the shared edge
+    gpu.gp0({ 0x2A080808, vertex(100, 50), vertex(140, 50), vertex(113, 81), vertex(153, 81) });
+    
+    u32 once  = 0;
+    u32 twice = 0;
+    
+    count_coverage(gpu, once, twice);
+    
+    CHECK_EQ(twice, 0u);
+    CHECK_EQ(once,  40u * 31u);
+}
+
+TEST(software_gouraud_simd_matches_scalar)
+{
+    std::vector<u16> scalar;
+    
+    {
+        TestGPU gpu;
+        gpu.set_span_path(SoftwareRenderer::SpanPath::Scalar);
+        
+        draw_scene(gpu);
+        
+        const u16* vram = gpu.vram();
+        scalar.assign(vram, vram + 1024 * 512);
+    }
+    
+    //a cpu without one of them draws with the scalar path, which trivially matches
+    for(SoftwareRenderer::SpanPath path : { SoftwareRenderer::SpanPath::SSE41, SoftwareRenderer::SpanPath::AVX2 })
+    {
+        TestGPU gpu;
+        gpu.set_span_path(path);
+        
+        draw_scene(gpu);
+        
+        const u16* vram = gpu.vram();
+        
+        CHECK(std::vector<u16>(vram, vram + 1024 * 512) == scalar);
+    }
+}
+
+TEST(software_threads_match_a_single_thread)
+{
+    std::vector<u16> single;
+    
+    {
+        TestGPU gpu;
+        
+        draw_scene(gpu);
+        
+        const u16* vram = gpu.vram();
+        single.assign(vram, vram + 1024 * 512);
+    }
+    
+    Config config;
+    config.render_threads = 4;
+    
+    TestGPU gpu(config);
+    
+    draw_scene(gpu);
+    
+    const u16* vram = gpu.vram();
+    
+    CHECK(std::vector<u16>(vram, vram + 1024 * 512) == single);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+/**
+ * minimal self registering test cases, tests/main.cpp runs them all
+ *
+ * TEST(name) { ... } defines a case, CHECK and CHECK_EQ report a failure and
+ * let the case carry on so one run shows every broken expectation
+ */
+struct TestCase
+{
+    const char* name;
+    void      (*run)();
+    
+    static std::vector<TestCase>& all()
+    {
+        static std::vector<TestCase> cases;
+        return cases;
+    }
+    
+    //failed expectations of the case being run
+    static inline unsigned failures = 0;
+    
+    static void fail(const char* file, int line, const char* expression)
+    {
+        std::printf("%s:%d: check failed: %s\n", file, line, expression);
+        failures++;
+    }
+    
+    static void fail(const char* file, int line, const char* expression, unsigned long long actual, unsigned long long expected)
+    {
+        std::printf("%s:%d: check failed: %s, got 0x%llx, expected 0x%llx\n", file, line, expression, actual, expected);
+        failures++;
+    }
+};
+
+struct TestRegistration
+{
+    TestRegistration(const char* name, void (*run)())
+    {
+        TestCase::all().push_back({ name, run });
+    }
+};
+
+#define TEST(name)                                                                  \
+    static void name();                                                             \
+    static TestRegistration name##_registration(#name, name);                       \
+    static void name()
+
+#define CHECK(expression)                                                           \
+    do                                                                              \
+    {                                                                               \
+        if(!(expression))                                                           \
+        {                                                                           \
+            TestCase::fail(__FILE__, __LINE__, #expression);                        \
+        }                                                                           \
+    } while(0)
+
+#define CHECK_EQ(actual, expected)                                                  \
+    do                                                                              \
+    {                                                                               \
+        auto test_actual   = (actual);                                              \
+        auto test_expected = (expected);                                            \
+                                                                                    \
+        if(!(test_actual == test_expected))                                         \
+        {                                                                           \
+            TestCase::fail(__FILE__, __LINE__, #actual " == " #expected,            \
+                           static_cast<unsigned long long>(test_actual),            \
+                           static_cast<unsigned long long>(test_expected));         \
+        }                                                                           \
+    } while(0)
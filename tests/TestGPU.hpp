@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../GPU.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#ifdef main
+#undef main
+#endif
+
+/**
+ * headless GPU without a CPU, with access to its VRAM
+ */
+class TestGPU : public GPU
+{
+public:
+    
+    explicit TestGPU(Config config = Config()) : GPU(nullptr)
+    {
+        config.headless = true;
+        
+        if(config.renderer == Config::RendererType::OpenGL)
+        {
+            config.renderer = Config::RendererType::Software;
+        }
+        
+        if(config.render_threads == 0)
+        {
+            config.render_threads = 1;
+        }
+        
+        configure(config);
+        gp1(0x00000000);
+    }
+    
+    void gp0(std::initializer_list<u32> words)
+    {
+        for(u32 word : words)
+        {
+            set(static_cast<u8>(GPUReg::GP0_READ), word);
+        }
+    }
+    
+    /**
+     * GP0 words the way DMA writes them, count at a time
+     */
+    void gp0_burst(const std::vector<u32>& words, size_t count)
+    {
+        for(size_t i = 0; i < words.size(); i += count)
+        {
+            gp0_write_burst(words.data() + i, std::min(count, words.size() - i));
+        }
+    }
+    
+    void gp1(u32 word)
+    {
+        set(static_cast<u8>(GPUReg::GP1_STAT), word);
+    }
+    
+    u32 stat()
+    {
+        return get(static_cast<u8>(GPUReg::GP1_STAT));
+    }
+    
+    /**
+     * GP0_LDIMAGE of width x height pixels at x, y
+     */
+    void load_image(u16 x, u16 y, u16 width, u16 height, const u16* pixels)
+    {
+        gp0({ 0xA0000000, static_cast<u32>(x | (y << 16)), static_cast<u32>(width | (height << 16)) });
+        
+        u32 count = width * height;
+        
+        for(u32 i = 0; i < count; i += 2)
+        {
+            u32 high = i + 1 < count ? pixels[i + 1] : 0;
+            
+            gp0({ pixels[i] | (high << 16) });
+        }
+    }
+    
+    /**
+     * open the whole of VRAM for drawing
+     */
+    void full_drawing_area()
+    {
+        gp0({ 0xE3000000, 0xE4000000 | 1023 | (511 << 10), 0xE5000000 });
+    }
+    
+    void set_span_path(SoftwareRenderer::SpanPath path)
+    {
+        sync();
+        m_software_renderer.set_span_path(path);
+    }
+    
+    u16 pixel(u32 x, u32 y)
+    {
+        sync();
+        m_software_renderer.flush();
+        
+        return m_vram[y][x];
+    }
+    
+    const u16* vram()
+    {
+        sync();
+        m_software_renderer.flush();
+        
+        return &m_vram[0][0];
+    }
+};
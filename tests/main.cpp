@@ -0,0 +1,42 @@
+#include "Test.hpp"
+
+#include <cstring>
+
+/**
+ * runs every registered case, or only those whose name contains the first argument
+ *
+ * usage: tests [filter]
+ */
+int main(int argc, const char* argv[])
+{
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    
+    unsigned run    = 0;
+    unsigned failed = 0;
+    
+    for(const TestCase& test : TestCase::all())
+    {
+        if(filter != nullptr && std::strstr(test.name, filter) == nullptr)
+        {
+            continue;
+        }
+        
+        TestCase::failures = 0;
+        test.run();
+        run++;
+        
+        if(TestCase::failures != 0)
+        {
+            std::printf("FAILED %s\n", test.name);
+            failed++;
+        }
+        else
+        {
+            std::printf("ok     %s\n", test.name);
+        }
+    }
+    
+    std::printf("%u of %u tests passed\n", run - failed, run);
+    
+    return failed != 0 ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "../GPU.hpp"
+#include "../GPUCapture.hpp"
+#include "../Scheduler.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+#ifdef main
+#undef main
+#endif
+
+/**
+ * plays a capture recorded with --record back into the GPU without a CPU,
+ * as fast as the renderer goes, and reports how long it took
+ *
+ * GPUREAD reads are replayed too, which drains VRAM readbacks like the
+ * game did, the words read back are compared with the recorded ones
+ *
+ * usage: gpu_replay [emulator options] capture
+ */
+int main(int argc, const char* argv[])
+{
+    Config config = Config::parse(argc, argv);
+    
+    const char* path = config.psxexe_path;
+    
+    if(path == nullptr)
+    {
+        std::printf("usage: %s [options] capture\n", argv[0]);
+        return 1;
+    }
+    
+    //never record the replay into itself
+    config.capture_path = nullptr;
+    
+    GPUCaptureReader reader;
+    
+    if(!reader.open(path))
+    {
+        return 1;
+    }
+    
+    GPU* gpu = new GPU(nullptr);
+    gpu->configure(config);
+    
+    GPUCapture::Record      record;
+    u64                     cycle = 0;
+    const std::vector<u32>* words = nullptr;
+    
+    u64 records = 0;
+    u64 count   = 0;
+    u32 frames  = 0;
+    
+    std::vector<u32> read;
+    u64              mismatches = 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    while(reader.next(record, cycle, words))
+    {
+        switch(record)
+        {
+            case GPUCapture::Record::GP0:      { gpu->set(static_cast<u8>(GPUReg::GP0_READ), (*words)[0]); break; }
+            case GPUCapture::Record::GP1:      { gpu->set(static_cast<u8>(GPUReg::GP1_STAT), (*words)[0]); break; }
+            case GPUCapture::Record::GP0Burst: { gpu->gp0_write_burst(words->data(), words->size()); break; }
+            case GPUCapture::Record::VBlank:   { gpu->vblank(); frames++; break; }
+            
+            case GPUCapture::Record::GPURead:
+            {
+                read.resize(words->size());
+                gpu->gpuread_burst(read.data(), read.size());
+                
+                mismatches += read != *words;
+                break;
+            }
+        }
+        
+        records++;
+        count += words->size();
+    }
+    
+    gpu->sync();
+    
+    auto   end      = std::chrono::steady_clock::now();
+    double wall     = std::chrono::duration<double, std::milli>(end - start).count();
+    double emulated = static_cast<double>(cycle) / Scheduler::ClockRate * 1000.0;
+    
+    std::printf("%llu records, %llu words, %u frames\n", static_cast<unsigned long long>(records), static_cast<unsigned long long>(count), frames);
+    std::printf("emulated %.1f ms, replayed in %.1f ms", emulated, wall);
+    
+    if(frames != 0)
+    {
+        std::printf(", %.3f ms/frame", wall / frames);
+    }
+    
+    if(wall > 0.0)
+    {
+        std::printf(", %.2fx real time", emulated / wall);
+    }
+    
+    std::printf("\n");
+    
+    if(mismatches != 0)
+    {
+        std::printf("warning: %llu GPUREAD reads differ from the recording\n", static_cast<unsigned long long>(mismatches));
+    }
+    
+    delete gpu;
+    
+    return 0;
+}